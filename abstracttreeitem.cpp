@@ -22,21 +22,66 @@
  */
 
 #include "abstracttreeitem.h"
+#include "treeaggregate.h"
+#include "treeiterator.h"
 
 #include <QDebug>
+#include <QtNumeric>
+
+namespace {
+
+struct DumpVisitor
+{
+    bool enter(const AbstractTreeItem *item, int depth)
+    {
+        QString fill(indent + depth, QLatin1Char(' '));
+        qDebug() << qPrintable(fill + QLatin1String("{"));
+        qDebug() << qPrintable(fill + QLatin1String(" ") + item->toString());
+        qDebug() << qPrintable(fill + QLatin1String(" ") + QLatin1String("this")) << item;
+        qDebug() << qPrintable(fill + QLatin1String(" ") + QLatin1String("parent")) << item->parent();
+        qDebug() << qPrintable(fill + QLatin1String(" ") + QLatin1String("children")) << item->children();
+        return true;
+    }
+
+    void leave(const AbstractTreeItem *item, int depth)
+    {
+        Q_UNUSED(item)
+        QString fill(indent + depth, QLatin1Char(' '));
+        qDebug() << qPrintable(fill + QLatin1String("}"));
+    }
+
+    int indent;
+};
+
+}
 
 AbstractTreeItem::AbstractTreeItem(AbstractTreeItem *parent)
     : _parent(0)
     , _children(QList<AbstractTreeItem*>())
+    , _row(0)
+    , _validRows(0)
 {
     setParent(parent);
 }
 
 AbstractTreeItem::~AbstractTreeItem()
 {
-    qDeleteAll(_children);
+    // Leaves go first, so deep trees are deleted without recursion and
+    // nobody looks itself up in _children
+    AbstractTreeItem *item = this;
+    while (!_children.isEmpty()) {
+        while (!item->_children.isEmpty())
+            item = item->_children.last();
+
+        AbstractTreeItem *parent = item->_parent;
+        parent->_children.removeLast();
+        item->_parent = 0;
+        delete item;
+        item = parent;
+    }
+
     if (_parent)
-        _parent->_children.removeOne(this);
+        _parent->removeChild(this);
 }
 
 void AbstractTreeItem::setRow(int row)
@@ -45,23 +90,37 @@ void AbstractTreeItem::setRow(int row)
     if (!_parent)
         return;
 
-    _parent->_children.move(this->row(), row);
+    int oldRow = this->row();
+    _parent->_children.move(oldRow, row);
+    _parent->invalidateRows(qMin(oldRow, row));
+    _parent->childrenChanged();
 }
 
 int AbstractTreeItem::row() const
 {
-    return _parent ? _parent->_children.indexOf(const_cast<AbstractTreeItem*>(this)) : 0;
+    if (!_parent)
+        return 0;
+
+    if (_row >= _parent->_validRows)
+        _parent->updateRows();
+
+    return _row;
 }
 
 void AbstractTreeItem::setParent(AbstractTreeItem *newParent)
 {
     if (_parent)
-        _parent->_children.removeOne(this);
+        _parent->removeChild(this);
 
-    if (newParent)
+    if (newParent) {
+        newParent->ensureChildren();
+        _row = newParent->_children.size();
         newParent->_children.append(this);
+    }
 
     _parent = newParent;
+    if (newParent)
+        newParent->childrenChanged();
 }
 
 AbstractTreeItem *AbstractTreeItem::parent() const
@@ -77,8 +136,12 @@ void AbstractTreeItem::insertChild(int row, AbstractTreeItem *child)
     if (child->_parent)
         child->_parent->removeChild(child);
 
+    ensureChildren();
     child->_parent = this;
+    child->_row = row;
     _children.insert(row, child);
+    invalidateRows(row);
+    childrenChanged();
 }
 
 void AbstractTreeItem::appendChild(AbstractTreeItem *child)
@@ -89,20 +152,94 @@ void AbstractTreeItem::appendChild(AbstractTreeItem *child)
     if (child->_parent)
         child->_parent->removeChild(child);
 
+    ensureChildren();
     child->_parent = this;
+    child->_row = _children.size();
     _children.append(child);
+    childrenChanged();
+}
+
+void AbstractTreeItem::insertChildren(int row, const QList<AbstractTreeItem*> &children)
+{
+    ensureChildren();
+    Q_ASSERT(row >= 0 && row <= _children.size());
+
+    if (children.isEmpty())
+        return;
+
+    foreach (AbstractTreeItem *child, children) {
+        Q_ASSERT(child);
+        Q_ASSERT(!child->_parent);
+        child->_parent = this;
+    }
+
+    _children.reserve(_children.size() + children.size());
+    if (row == _children.size()) {
+        foreach (AbstractTreeItem *child, children) {
+            child->_row = _children.size();
+            _children.append(child);
+        }
+    }
+    else {
+        QList<AbstractTreeItem*> tail = _children.mid(row);
+        _children.erase(_children.begin() + row, _children.end());
+        _children.append(children);
+        _children.append(tail);
+        invalidateRows(row);
+    }
+    childrenChanged();
 }
 
 void AbstractTreeItem::removeChild(AbstractTreeItem *child)
 {
     Q_ASSERT(child);
-    Q_ASSERT(_children.contains(child));
+    Q_ASSERT(child->_parent == this);
 
-    _children.removeOne(child);
+    int row = child->row();
+    _children.removeAt(row);
+    invalidateRows(row);
+    child->_parent = 0;
+    childrenChanged();
+}
+
+QList<AbstractTreeItem*> AbstractTreeItem::takeChildren(int row, int count)
+{
+    ensureChildren();
+    Q_ASSERT(row >= 0 && count >= 0 && row + count <= _children.size());
+
+    QList<AbstractTreeItem*> taken;
+    if (count == 0)
+        return taken;
+
+    if (row == 0 && count == _children.size()) {
+        taken.swap(_children);
+    }
+    else {
+        taken = _children.mid(row, count);
+        _children.erase(_children.begin() + row, _children.begin() + row + count);
+    }
+    invalidateRows(row);
+
+    foreach (AbstractTreeItem *child, taken) {
+        child->_parent = 0;
+    }
+    childrenChanged();
+    return taken;
+}
+
+void AbstractTreeItem::reorderChildren(const QList<AbstractTreeItem*> &children)
+{
+    // children must hold the current children in their new order
+    ensureChildren();
+    Q_ASSERT(children.size() == _children.size());
+    _children = children;
+    invalidateRows(0);
+    childrenChanged();
 }
 
 AbstractTreeItem *AbstractTreeItem::child(int row) const
 {
+    ensureChildren();
     Q_ASSERT(row < childCount());
     if (row < childCount())
         return _children.at(row);
@@ -112,25 +249,75 @@ AbstractTreeItem *AbstractTreeItem::child(int row) const
 
 int AbstractTreeItem::childCount() const
 {
+    ensureChildren();
     return _children.size();
 }
 
 QList<AbstractTreeItem*> AbstractTreeItem::children() const
 {
+    ensureChildren();
     return _children;
 }
 
+bool AbstractTreeItem::hasPendingChildren() const
+{
+    return false;
+}
+
+double AbstractTreeItem::aggregateValue(int column) const
+{
+    Q_UNUSED(column)
+    return qQNaN();
+}
+
+QVector<double> AbstractTreeItem::pendingAggregates(const TreeAggregator &aggregator) const
+{
+    return aggregator.empty();
+}
+
 void AbstractTreeItem::dump(int indent) const
 {
-    QString fill(indent, QLatin1Char(' '));
-    qDebug() << qPrintable(fill + QLatin1String("{"));
-    qDebug() << qPrintable(fill + QLatin1String(" ") + toString());
-    qDebug() << qPrintable(fill + QLatin1String(" ") + QLatin1String("this")) << this;
-    qDebug() << qPrintable(fill + QLatin1String(" ") + QLatin1String("parent")) << _parent;
-    qDebug() << qPrintable(fill + QLatin1String(" ") + QLatin1String("children")) << _children;
+    DumpVisitor visitor = { indent };
+    visitTree(this, visitor);
+}
+
+void AbstractTreeItem::loadChildren() const
+{
+}
+
+void AbstractTreeItem::childrenChanged()
+{
+}
 
-    foreach (AbstractTreeItem *item, _children) {
-        item->dump(indent + 1);
+void AbstractTreeItem::adoptChildren(const QList<AbstractTreeItem*> &children)
+{
+    Q_ASSERT(_children.isEmpty());
+
+    foreach (AbstractTreeItem *child, children) {
+        Q_ASSERT(!child->_parent);
+        child->_parent = this;
+        child->_row = _children.size();
+        _children.append(child);
     }
-    qDebug() << qPrintable(fill + QLatin1String("}"));
+    _validRows = _children.size();
+}
+
+void AbstractTreeItem::ensureChildren() const
+{
+    if (_children.isEmpty())
+        loadChildren();
+}
+
+void AbstractTreeItem::invalidateRows(int from) const
+{
+    if (from < _validRows)
+        _validRows = from;
+}
+
+void AbstractTreeItem::updateRows() const
+{
+    for (int i = _validRows; i < _children.size(); ++i)
+        _children.at(i)->_row = i;
+
+    _validRows = _children.size();
 }
@@ -25,6 +25,9 @@
 
 #include <QList>
 #include <QString>
+#include <QVector>
+
+class TreeAggregator;
 
 class AbstractTreeItem
 {
@@ -40,17 +43,48 @@ public:
 
     void insertChild(int row, AbstractTreeItem *child);
     void appendChild(AbstractTreeItem *child);
+    void insertChildren(int row, const QList<AbstractTreeItem*> &children);
     void removeChild(AbstractTreeItem *child);
+    QList<AbstractTreeItem*> takeChildren(int row, int count);
+    void reorderChildren(const QList<AbstractTreeItem*> &children);
 
     AbstractTreeItem *child(int row) const;
     int childCount() const;
     QList<AbstractTreeItem*> children() const;
 
+    // Whether loadChildren() still has children to make. Walks that keep
+    // bookkeeping leave these out and catch up when the children are made.
+    virtual bool hasPendingChildren() const;
+
+    // Number the item adds to sums, minimums and maximums, NaN for none
+    virtual double aggregateValue(int column) const;
+    // Aggregates over the children loadChildren() is still to make,
+    // worked out without making them
+    virtual QVector<double> pendingAggregates(const TreeAggregator &aggregator) const;
+
     virtual AbstractTreeItem *clone() const = 0;
     void dump(int indent = 0) const;
     virtual QString toString() const = 0;
 
+protected:
+    // Called before the children are used while the list is empty, so
+    // subclasses can create them on demand with adoptChildren()
+    virtual void loadChildren() const;
+    // Called after children were added, removed or moved
+    virtual void childrenChanged();
+
+    void adoptChildren(const QList<AbstractTreeItem*> &children);
+
 private:
+    void ensureChildren() const;
+    void invalidateRows(int from) const;
+    void updateRows() const;
+
     AbstractTreeItem *_parent;
     QList<AbstractTreeItem*> _children;
+
+    // Cached position in the parent's children list. Children from
+    // _validRows onwards are renumbered lazily on the next row() call.
+    mutable int _row;
+    mutable int _validRows;
 };
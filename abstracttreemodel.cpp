@@ -23,22 +23,39 @@
 
 #include "abstracttreeitem.h"
 #include "abstracttreemodel.h"
+#include "treechildprovider.h"
+#include "treeiterator.h"
+#include "treemodelstats.h"
 
 #include <QDebug>
+#include <QtNumeric>
 
 AbstractTreeModel::AbstractTreeModel(AbstractTreeItem *root, QObject *parent)
     : QAbstractItemModel(parent)
     , _root(root)
+    , _provider(0)
+    , _fetchPageSize(1000)
+    , _paging(false)
+    , _aggregator(0)
 {
+    connect(this, SIGNAL(rowsInserted(QModelIndex,int,int)), SLOT(rowsEdited(QModelIndex)));
+    connect(this, SIGNAL(rowsRemoved(QModelIndex,int,int)), SLOT(rowsEdited(QModelIndex)));
+    connect(this, SIGNAL(rowsMoved(QModelIndex,int,int,QModelIndex,int)),
+            SLOT(rowsMovedLocally(QModelIndex,int,int,QModelIndex)));
+    connect(this, SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)), SLOT(forgetFetched(QModelIndex,int,int)));
+    connect(this, SIGNAL(modelReset()), SLOT(forgetAllFetched()));
 }
 
 AbstractTreeModel::~AbstractTreeModel()
 {
+    delete _aggregator;
     delete _root;
 }
 
 QModelIndex AbstractTreeModel::index(int row, int column, const QModelIndex &parent) const
 {
+    TREEMODEL_PROBE(Index);
+
     if (!hasIndex(row, column, parent))
         return QModelIndex();
 
@@ -51,7 +68,7 @@ QModelIndex AbstractTreeModel::index(int row, int column, const QModelIndex &par
 
     AbstractTreeItem *childItem = 0;
     if (row >= 0 && row < parentItem->childCount())
-        childItem = parentItem->children().at(row);
+        childItem = parentItem->child(row);
 
     if (childItem)
         return createIndex(row, column, childItem);
@@ -62,6 +79,8 @@ QModelIndex AbstractTreeModel::index(int row, int column, const QModelIndex &par
 
 QModelIndex	AbstractTreeModel::parent(const QModelIndex &index) const
 {
+    TREEMODEL_PROBE(Parent);
+
     if (!index.isValid())
         return QModelIndex();
 
@@ -80,6 +99,8 @@ QModelIndex	AbstractTreeModel::parent(const QModelIndex &index) const
 
 int	AbstractTreeModel::rowCount(const QModelIndex &parent) const
 {
+    TREEMODEL_PROBE(RowCount);
+
     if (parent.column() > 0)
         return 0;
 
@@ -89,10 +110,300 @@ int	AbstractTreeModel::rowCount(const QModelIndex &parent) const
     else
         parentItem = static_cast<AbstractTreeItem*>(parent.internalPointer());
 
-    return parentItem->children().size();
+    return parentItem->childCount();
+}
+
+bool AbstractTreeModel::hasChildren(const QModelIndex &parent) const
+{
+    if (parent.column() > 0)
+        return false;
+
+    AbstractTreeItem *parentItem = item(parent);
+    if (parentItem->childCount() > 0)
+        return true;
+
+    return _provider && _provider->childCount(parentItem) > 0;
+}
+
+bool AbstractTreeModel::removeRows(int row, int count, const QModelIndex &parent)
+{
+    AbstractTreeItem *parentItem = item(parent);
+    if (count <= 0 || row < 0 || row + count > parentItem->childCount())
+        return false;
+
+    TREEMODEL_PROBE_CALL(Notify, beginRemoveRows(parent, row, row + count - 1));
+    QList<AbstractTreeItem*> items = parentItem->takeChildren(row, count);
+    TREEMODEL_PROBE_CALL(Notify, endRemoveRows());
+
+    if (_aggregator)
+        aggregatesChanged(_aggregator->removed(parentItem, row, items));
+    qDeleteAll(items);
+    return true;
+}
+
+bool AbstractTreeModel::moveRows(const QModelIndex &sourceParent, int sourceRow, int count,
+                                 const QModelIndex &destinationParent, int destinationChild)
+{
+    AbstractTreeItem *from = item(sourceParent);
+    AbstractTreeItem *to = item(destinationParent);
+    if (count <= 0 || sourceRow < 0 || sourceRow + count > from->childCount()
+            || destinationChild < 0 || destinationChild > to->childCount()) {
+        return false;
+    }
+
+    // Rows can't move below themselves
+    for (AbstractTreeItem *node = to; node->parent(); node = node->parent()) {
+        if (node->parent() == from && node->row() >= sourceRow && node->row() < sourceRow + count)
+            return false;
+    }
+
+    // Refuses moves that leave everything in place
+    bool moving;
+    TREEMODEL_PROBE_CALL(Notify, moving = beginMoveRows(sourceParent, sourceRow, sourceRow + count - 1,
+                                                        destinationParent, destinationChild));
+    if (!moving)
+        return false;
+
+    QList<AbstractTreeItem*> moved = from->takeChildren(sourceRow, count);
+    if (from == to && destinationChild > sourceRow)
+        destinationChild -= count;
+    to->insertChildren(destinationChild, moved);
+    TREEMODEL_PROBE_CALL(Notify, endMoveRows());
+
+    if (_aggregator)
+        aggregatesChanged(_aggregator->moved(from, sourceRow, to, moved));
+    return true;
+}
+
+AbstractTreeItem *AbstractTreeModel::itemFromIndex(const QModelIndex &index) const
+{
+    return item(index);
+}
+
+QModelIndex AbstractTreeModel::indexFromItem(AbstractTreeItem *item, int column) const
+{
+    if (!item || item == _root)
+        return QModelIndex();
+
+    return createIndex(item->row(), column, item);
+}
+
+void AbstractTreeModel::setChildProvider(TreeChildProvider *provider)
+{
+    _provider = provider;
+}
+
+TreeChildProvider *AbstractTreeModel::childProvider() const
+{
+    return _provider;
+}
+
+void AbstractTreeModel::setFetchPageSize(int size)
+{
+    _fetchPageSize = qMax(size, 1);
+}
+
+int AbstractTreeModel::fetchPageSize() const
+{
+    return _fetchPageSize;
+}
+
+bool AbstractTreeModel::canFetchMore(const QModelIndex &parent) const
+{
+    if (!_provider || parent.column() > 0)
+        return false;
+
+    AbstractTreeItem *parentItem = item(parent);
+    return fetchedRows(parentItem) < _provider->childCount(parentItem);
+}
+
+void AbstractTreeModel::fetchMore(const QModelIndex &parent)
+{
+    if (!canFetchMore(parent))
+        return;
+
+    AbstractTreeItem *parentItem = item(parent);
+    int fetched = fetchedRows(parentItem);
+    int count = qMin(_fetchPageSize, _provider->childCount(parentItem) - fetched);
+
+    QList<AbstractTreeItem*> items = _provider->fetchChildren(parentItem, fetched, count);
+    if (items.isEmpty())
+        return;
+
+    QHash<const AbstractTreeItem*, FetchState>::iterator it = _fetched.find(parentItem);
+    if (it == _fetched.end()) {
+        // Children that were here already may be local, so they keep the
+        // parent from being evicted
+        FetchState state = { fetched, fetched > 0 };
+        it = _fetched.insert(parentItem, state);
+    }
+    it.value().rows += items.size();
+
+    int first = parentItem->childCount();
+    _paging = true;
+    TREEMODEL_PROBE_CALL(Notify, beginInsertRows(parent, first, first + items.size() - 1));
+    parentItem->insertChildren(first, items);
+    TREEMODEL_PROBE_CALL(Notify, endInsertRows());
+    _paging = false;
+
+    if (_aggregator)
+        aggregatesChanged(_aggregator->inserted(parentItem, items));
+}
+
+void AbstractTreeModel::evict(const QModelIndex &parent)
+{
+    // Only children that can be fetched again are dropped
+    if (!_provider || parent.column() > 0)
+        return;
+
+    AbstractTreeItem *parentItem = item(parent);
+    QHash<const AbstractTreeItem*, FetchState>::const_iterator it = _fetched.constFind(parentItem);
+    if (it == _fetched.constEnd() || it.value().edited || parentItem->childCount() == 0)
+        return;
+
+    _paging = true;
+    evictRows(parentItem, 0, parentItem->childCount());
+    _paging = false;
+    _fetched.remove(parentItem);
+}
+
+void AbstractTreeModel::evictRows(AbstractTreeItem *parent, int row, int count)
+{
+    AbstractTreeModel::removeRows(row, count, indexFromItem(parent));
+}
+
+int AbstractTreeModel::fetchedRows(const AbstractTreeItem *parent) const
+{
+    // Children of parents never paged here, or put back after a removal,
+    // stand for the first provider rows
+    QHash<const AbstractTreeItem*, FetchState>::const_iterator it = _fetched.constFind(parent);
+    return it != _fetched.constEnd() ? it.value().rows : parent->childCount();
+}
+
+void AbstractTreeModel::rowsEdited(const QModelIndex &parent)
+{
+    if (_paging || _fetched.isEmpty())
+        return;
+
+    QHash<const AbstractTreeItem*, FetchState>::iterator it = _fetched.find(item(parent));
+    if (it != _fetched.end())
+        it.value().edited = true;
+}
+
+void AbstractTreeModel::rowsMovedLocally(const QModelIndex &sourceParent, int start, int end,
+                                         const QModelIndex &destinationParent)
+{
+    Q_UNUSED(start)
+    Q_UNUSED(end)
+    rowsEdited(sourceParent);
+    rowsEdited(destinationParent);
+}
+
+void AbstractTreeModel::forgetFetched(const QModelIndex &parent, int first, int last)
+{
+    // Removed items may be deleted, and their addresses reused
+    if (_fetched.isEmpty())
+        return;
+
+    AbstractTreeItem *parentItem = item(parent);
+    for (int row = first; row <= last; ++row) {
+        for (TreePreOrderIterator<AbstractTreeItem> it(parentItem->child(row)); it.item(); it.next()) {
+            _fetched.remove(it.item());
+            if (it.item()->hasPendingChildren())
+                it.skipChildren();
+        }
+    }
+}
+
+void AbstractTreeModel::forgetAllFetched()
+{
+    _fetched.clear();
+}
+
+int AbstractTreeModel::addAggregate(TreeAggregate::Function function, int column)
+{
+    bool created = !_aggregator;
+    if (created)
+        _aggregator = new TreeAggregator;
+
+    int count = _aggregator->count();
+    int slot = _aggregator->add(TreeAggregate(function, column));
+    if (created || _aggregator->count() != count)
+        _aggregator->rebuild(_root);
+    return slot;
+}
+
+void AbstractTreeModel::clearAggregates()
+{
+    delete _aggregator;
+    _aggregator = 0;
+}
+
+int AbstractTreeModel::preOrderPosition(const QModelIndex &index) const
+{
+    if (!_aggregator || !index.isValid())
+        return -1;
+
+    return _aggregator->position(item(index));
+}
+
+QModelIndex AbstractTreeModel::indexAtPreOrderPosition(int position) const
+{
+    if (!_aggregator)
+        return QModelIndex();
+
+    return indexFromItem(_aggregator->itemAt(_root, position));
 }
 
 AbstractTreeItem *AbstractTreeModel::root() const
 {
     return _root;
 }
+
+AbstractTreeItem *AbstractTreeModel::item(const QModelIndex &index) const
+{
+    if (!index.isValid())
+        return _root;
+
+    return static_cast<AbstractTreeItem*>(index.internalPointer());
+}
+
+TreeAggregator *AbstractTreeModel::aggregator() const
+{
+    return _aggregator;
+}
+
+QVariant AbstractTreeModel::aggregateData(const QModelIndex &index, int role) const
+{
+    int slot = role - AggregateRole;
+    if (!_aggregator || !index.isValid() || slot < 0 || slot >= _aggregator->count())
+        return QVariant();
+
+    double value = _aggregator->value(item(index), slot);
+    if (qIsNaN(value))
+        return QVariant();
+    return value;
+}
+
+void AbstractTreeModel::rebuildAggregates()
+{
+    if (_aggregator)
+        _aggregator->rebuild(_root);
+}
+
+void AbstractTreeModel::aggregatesChanged(const QList<AbstractTreeItem*> &items)
+{
+    if (items.isEmpty())
+        return;
+
+    QVector<int> roles;
+    for (int slot = 0; slot < _aggregator->count(); ++slot)
+        roles.append(AggregateRole + slot);
+
+    int columns = columnCount(QModelIndex());
+    foreach (AbstractTreeItem *changed, items) {
+        if (changed != _root)
+            TREEMODEL_PROBE_CALL(Notify, emit dataChanged(indexFromItem(changed), indexFromItem(changed, columns - 1),
+                                                          roles));
+    }
+}
@@ -23,25 +23,97 @@
 
 #pragma once
 
+#include "treeaggregate.h"
+
 #include <QAbstractItemModel>
+#include <QHash>
 
 class AbstractTreeItem;
+class TreeChildProvider;
 
 class AbstractTreeModel : public QAbstractItemModel
 {
     Q_OBJECT
 
 public:
+    enum
+    {
+        // data() of an item's aggregate is read with AggregateRole plus
+        // the value addAggregate() returned
+        AggregateRole = Qt::UserRole + 0x100
+    };
+
     explicit AbstractTreeModel(AbstractTreeItem *root, QObject *parent = 0);
     ~AbstractTreeModel() override;
 
     QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
     QModelIndex parent(const QModelIndex & index) const override;
     int rowCount(const QModelIndex & parent = QModelIndex()) const override;
+    bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+    bool removeRows(int row, int count, const QModelIndex &parent = QModelIndex()) override;
+    bool moveRows(const QModelIndex &sourceParent, int sourceRow, int count,
+                  const QModelIndex &destinationParent, int destinationChild) override;
+
+    AbstractTreeItem *itemFromIndex(const QModelIndex &index) const;
+    QModelIndex indexFromItem(AbstractTreeItem *item, int column = 0) const;
+
+    void setChildProvider(TreeChildProvider *provider);
+    TreeChildProvider *childProvider() const;
+    void setFetchPageSize(int size);
+    int fetchPageSize() const;
+
+    // Provider rows are counted per parent apart from the children, so
+    // rows added, removed or moved locally don't shift the next page.
+    // evict() leaves parents with such edits alone.
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+    void evict(const QModelIndex &parent);
+
+    // Aggregates over the descendants of every item, kept up to date on
+    // each change so reading one costs O(1). Returns the offset from
+    // AggregateRole to read it with.
+    int addAggregate(TreeAggregate::Function function, int column = 0);
+    void clearAggregates();
+    // Index of the item in a pre-order walk over the whole model, -1
+    // while no aggregates are kept
+    int preOrderPosition(const QModelIndex &index) const;
+    QModelIndex indexAtPreOrderPosition(int position) const;
 
 protected:
     AbstractTreeItem *root() const;
+    AbstractTreeItem *item(const QModelIndex &index) const;
+
+    TreeAggregator *aggregator() const;
+    QVariant aggregateData(const QModelIndex &index, int role) const;
+    void rebuildAggregates();
+    // Announces the aggregate roles of the items as changed
+    virtual void aggregatesChanged(const QList<AbstractTreeItem*> &items);
+    // Deletes rows for evict(). They can be fetched again, so unlike
+    // removeRows() this is no edit of the model's own.
+    virtual void evictRows(AbstractTreeItem *parent, int row, int count);
+
+private slots:
+    void rowsEdited(const QModelIndex &parent);
+    void rowsMovedLocally(const QModelIndex &sourceParent, int start, int end,
+                          const QModelIndex &destinationParent);
+    void forgetFetched(const QModelIndex &parent, int first, int last);
+    void forgetAllFetched();
 
 private:
+    struct FetchState
+    {
+        // Provider rows fetched so far
+        int rows;
+        // Whether rows were added, removed or moved here since
+        bool edited;
+    };
+
+    int fetchedRows(const AbstractTreeItem *parent) const;
+
     AbstractTreeItem *_root;
+    TreeChildProvider *_provider;
+    int _fetchPageSize;
+    QHash<const AbstractTreeItem*, FetchState> _fetched;
+    bool _paging;
+    TreeAggregator *_aggregator;
 };
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#include "flattreemodel.h"
+#include "treemodel.h"
+
+FlatTreeModel::FlatTreeModel(int columns, QObject *parent)
+    : QAbstractItemModel(parent)
+    , _columns(columns)
+    , _rootFirstChild(0)
+    , _rootChildCount(0)
+{
+}
+
+FlatTreeModel::~FlatTreeModel()
+{
+}
+
+void FlatTreeModel::setTree(const TreeItem *root)
+{
+    beginResetModel();
+
+    _parent.clear();
+    _firstChild.clear();
+    _childCount.clear();
+    _row.clear();
+    _cells.clear();
+
+    // Breadth-first, so that every child list lands on consecutive ids
+    QVector<const AbstractTreeItem*> nodes;
+    _rootFirstChild = 0;
+    _rootChildCount = root ? root->childCount() : 0;
+    for (int row = 0; row < _rootChildCount; ++row) {
+        nodes.append(root->child(row));
+        appendNode(-1, row);
+    }
+
+    for (int node = 0; node < nodes.size(); ++node) {
+        const AbstractTreeItem *item = nodes.at(node);
+        _firstChild[node] = nodes.size();
+        _childCount[node] = item->childCount();
+        for (int row = 0; row < item->childCount(); ++row) {
+            nodes.append(item->child(row));
+            appendNode(node, row);
+        }
+        setValues(node, static_cast<const TreeItem*>(item)->values());
+    }
+
+    endResetModel();
+}
+
+bool FlatTreeModel::appendChildren(const QVector<QStringList> &values, const QModelIndex &index)
+{
+    if (values.isEmpty() || rowCount(index) > 0 || index.column() > 0)
+        return false;
+
+    int first = _parent.size();
+    int parentNode = index.isValid() ? int(index.internalId()) : -1;
+
+    beginInsertRows(index, 0, values.size() - 1);
+    for (int row = 0; row < values.size(); ++row) {
+        int node = appendNode(parentNode, row);
+        setValues(node, values.at(row));
+    }
+
+    if (parentNode < 0) {
+        _rootFirstChild = first;
+        _rootChildCount = values.size();
+    }
+    else {
+        _firstChild[parentNode] = first;
+        _childCount[parentNode] = values.size();
+    }
+    endInsertRows();
+    return true;
+}
+
+void FlatTreeModel::clear()
+{
+    setTree(0);
+}
+
+int FlatTreeModel::nodeCount() const
+{
+    return _parent.size();
+}
+
+QModelIndex FlatTreeModel::index(int row, int column, const QModelIndex &parent) const
+{
+    if (!hasIndex(row, column, parent))
+        return QModelIndex();
+
+    int first = parent.isValid() ? _firstChild.at(int(parent.internalId())) : _rootFirstChild;
+    return createIndex(row, column, quintptr(first + row));
+}
+
+QModelIndex FlatTreeModel::parent(const QModelIndex &index) const
+{
+    if (!index.isValid())
+        return QModelIndex();
+
+    int parentNode = _parent.at(int(index.internalId()));
+    if (parentNode < 0)
+        return QModelIndex();
+
+    return createIndex(_row.at(parentNode), 0, quintptr(parentNode));
+}
+
+int FlatTreeModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.column() > 0)
+        return 0;
+
+    if (!parent.isValid())
+        return _rootChildCount;
+
+    return _childCount.at(int(parent.internalId()));
+}
+
+int FlatTreeModel::columnCount(const QModelIndex &parent) const
+{
+    Q_UNUSED(parent)
+    return _columns;
+}
+
+QVariant FlatTreeModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid())
+        return QVariant();
+
+    if (role == Qt::DisplayRole || role == Qt::EditRole)
+        return _cells.at(int(index.internalId()) * _columns + index.column());
+
+    return QVariant();
+}
+
+QVariant FlatTreeModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation == Qt::Orientation::Horizontal && role == Qt::DisplayRole) {
+        return QString("Column %1").arg(section);
+    }
+    else {
+        return QAbstractItemModel::headerData(section, orientation, role);
+    }
+}
+
+Qt::ItemFlags FlatTreeModel::flags(const QModelIndex &index) const
+{
+    if (!index.isValid())
+        return QAbstractItemModel::flags(index);
+
+    return Qt::ItemIsSelectable | Qt::ItemIsEnabled;
+}
+
+int FlatTreeModel::appendNode(int parent, int row)
+{
+    _parent.append(parent);
+    _firstChild.append(0);
+    _childCount.append(0);
+    _row.append(row);
+    _cells.resize(_cells.size() + _columns);
+    return _parent.size() - 1;
+}
+
+void FlatTreeModel::setValues(int node, const QStringList &values)
+{
+    int count = qMin(values.size(), _columns);
+    for (int column = 0; column < count; ++column)
+        _cells[node * _columns + column] = values.at(column);
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <QAbstractItemModel>
+#include <QStringList>
+#include <QVector>
+
+class AbstractTreeItem;
+class TreeItem;
+
+// Read-mostly tree model keeping its topology in flat arrays indexed by node
+// id. Children of a node always occupy consecutive ids, so index(), parent()
+// and rowCount() are plain array lookups. The node id is stored in
+// QModelIndex::internalId().
+class FlatTreeModel : public QAbstractItemModel
+{
+    Q_OBJECT
+
+public:
+    explicit FlatTreeModel(int columns = 3, QObject *parent = 0);
+    ~FlatTreeModel() override;
+
+    void setTree(const TreeItem *root);
+    bool appendChildren(const QVector<QStringList> &values, const QModelIndex &index);
+    void clear();
+
+    int nodeCount() const;
+
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+    QModelIndex parent(const QModelIndex &index) const override;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role) const override;
+    Qt::ItemFlags flags(const QModelIndex &index) const override;
+
+private:
+    int appendNode(int parent, int row);
+    void setValues(int node, const QStringList &values);
+
+    int _columns;
+    int _rootFirstChild;
+    int _rootChildCount;
+
+    QVector<int> _parent;
+    QVector<int> _firstChild;
+    QVector<int> _childCount;
+    QVector<int> _row;
+    QVector<QString> _cells;
+};
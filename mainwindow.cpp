@@ -28,12 +28,14 @@
 #include "treemodel.h"
 
 #include <QAction>
+#include <QApplication>
+#include <QClipboard>
 #include <QInputDialog>
+#include <QMimeData>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
-    , _copyedItem(nullptr)
 {
     ui->setupUi(this);
 
@@ -87,16 +89,19 @@ void MainWindow::copyItem()
     if (!index.isValid())
         return;
 
-    _copyedItem = static_cast<TreeItem*>(index.internalPointer());
-
+    // The clipboard keeps a snapshot, so later edits and removals don't
+    // change what gets pasted
+    TreeModel *model = qobject_cast<TreeModel*>(ui->treeView->model());
+    QApplication::clipboard()->setMimeData(model->mimeData(QModelIndexList() << index));
 }
 
 void MainWindow::pasteItem()
 {
-    if (!_copyedItem)
-        return;
-
+    const QMimeData *data = QApplication::clipboard()->mimeData();
     QModelIndex parent = ui->treeView->currentIndex();
     TreeModel *model = qobject_cast<TreeModel*>(ui->treeView->model());
-    model->add(_copyedItem->values(), parent);
+    if (!data || !model->canDropMimeData(data, Qt::CopyAction, -1, 0, parent))
+        return;
+
+    model->dropMimeData(data, Qt::CopyAction, -1, 0, parent);
 }
@@ -27,8 +27,6 @@
 
 #include <QMainWindow>
 
-class TreeItem;
-
 namespace Ui { class MainWindow; }
 
 class MainWindow : public QMainWindow
@@ -50,5 +48,4 @@ public slots:
 
 private:
     Ui::MainWindow *ui;
-    TreeItem *_copyedItem;
 };
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#include "stringpool.h"
+
+#include <QMutableSetIterator>
+
+StringPool::StringPool()
+    : _strings(QSet<QString>())
+{
+}
+
+StringPool::~StringPool()
+{
+}
+
+QString StringPool::intern(const QString &value)
+{
+    if (value.isEmpty())
+        return value;
+
+    QSet<QString>::const_iterator it = _strings.constFind(value);
+    if (it != _strings.constEnd())
+        return *it;
+
+    _strings.insert(value);
+    return value;
+}
+
+QStringList StringPool::intern(const QStringList &values)
+{
+    QStringList result;
+    result.reserve(values.size());
+    foreach (const QString &value, values) {
+        result.append(intern(value));
+    }
+    return result;
+}
+
+int StringPool::size() const
+{
+    return _strings.size();
+}
+
+int StringPool::purge()
+{
+    int removed = 0;
+    QMutableSetIterator<QString> it(_strings);
+    while (it.hasNext()) {
+        // Only the pool itself still holds this buffer
+        if (it.next().isDetached()) {
+            it.remove();
+            ++removed;
+        }
+    }
+    return removed;
+}
+
+void StringPool::clear()
+{
+    _strings.clear();
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+// Table of shared cell strings. Interned strings share a single buffer, so
+// repeated values cost one pointer per cell and equal cells compare by
+// address. An entry is dropped by purge() once no cell refers to it.
+class StringPool
+{
+public:
+    StringPool();
+    ~StringPool();
+
+    QString intern(const QString &value);
+    QStringList intern(const QStringList &values);
+
+    int size() const;
+    int purge();
+    void clear();
+
+private:
+    QSet<QString> _strings;
+};
@@ -0,0 +1,400 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#include "abstracttreeitem.h"
+#include "treeaggregate.h"
+#include "treeiterator.h"
+
+#include <QtNumeric>
+
+#include <algorithm>
+
+namespace {
+
+bool isSame(double left, double right)
+{
+    return left == right || (qIsNaN(left) && qIsNaN(right));
+}
+
+// NaN stands for no value and loses against any number
+double combined(TreeAggregate::Function function, double left, double right)
+{
+    switch (function) {
+    case TreeAggregate::DescendantCount:
+    case TreeAggregate::Sum:
+        return left + right;
+    case TreeAggregate::Minimum:
+        return qIsNaN(left) || right < left ? right : left;
+    case TreeAggregate::Height:
+    case TreeAggregate::Maximum:
+        return qIsNaN(left) || right > left ? right : left;
+    }
+    return left;
+}
+
+}
+
+TreeAggregate::TreeAggregate(Function function, int column)
+    : function(function)
+    , column(column)
+{
+}
+
+TreeAggregator::TreeAggregator()
+{
+    _aggregates.append(TreeAggregate(TreeAggregate::DescendantCount));
+}
+
+int TreeAggregator::add(const TreeAggregate &aggregate)
+{
+    for (int slot = 0; slot < _aggregates.size(); ++slot) {
+        const TreeAggregate &known = _aggregates.at(slot);
+        if (known.function != aggregate.function)
+            continue;
+        if (known.column == aggregate.column || known.function <= TreeAggregate::Height)
+            return slot;
+    }
+
+    _aggregates.append(aggregate);
+    return _aggregates.size() - 1;
+}
+
+int TreeAggregator::count() const
+{
+    return _aggregates.size();
+}
+
+TreeAggregate TreeAggregator::aggregate(int slot) const
+{
+    return _aggregates.at(slot);
+}
+
+void TreeAggregator::rebuild(AbstractTreeItem *root)
+{
+    _nodes.clear();
+    compute(root);
+}
+
+double TreeAggregator::value(const AbstractTreeItem *item, int slot) const
+{
+    return values(item).at(slot);
+}
+
+QList<AbstractTreeItem*> TreeAggregator::inserted(AbstractTreeItem *parent, const QList<AbstractTreeItem*> &items)
+{
+    QList<AbstractTreeItem*> changed;
+    foreach (AbstractTreeItem *item, items)
+        compute(item);
+    attach(parent, items, changed);
+    return changed;
+}
+
+QList<AbstractTreeItem*> TreeAggregator::removed(AbstractTreeItem *parent, int row,
+                                                 const QList<AbstractTreeItem*> &items)
+{
+    QList<AbstractTreeItem*> changed;
+    detach(parent, row, items, changed);
+    forget(items);
+    return changed;
+}
+
+QList<AbstractTreeItem*> TreeAggregator::moved(AbstractTreeItem *from, int row, AbstractTreeItem *to,
+                                               const QList<AbstractTreeItem*> &items)
+{
+    // The moved subtrees keep their own aggregates
+    QList<AbstractTreeItem*> changed;
+    if (from != to) {
+        detach(from, row, items, changed);
+        attach(to, items, changed);
+    } else if (!items.isEmpty()) {
+        // Same sizes in another order, offsets from the first moved row on
+        // are off
+        QVector<int> &offsets = _nodes[from].offsets;
+        int first = qMin(row, items.first()->row());
+        if (offsets.size() > first + 1)
+            offsets.resize(first + 1);
+    }
+    return changed;
+}
+
+QList<AbstractTreeItem*> TreeAggregator::changed(AbstractTreeItem *item, const QVector<double> &before)
+{
+    QList<AbstractTreeItem*> changed;
+    if (item->parent())
+        propagate(item->parent(), item->row(), before, contribution(item), changed);
+    return changed;
+}
+
+void TreeAggregator::loaded(const QList<AbstractTreeItem*> &items)
+{
+    foreach (AbstractTreeItem *item, items)
+        compute(item);
+}
+
+void TreeAggregator::reordered(const AbstractTreeItem *parent)
+{
+    QHash<const AbstractTreeItem*, Node>::iterator it = _nodes.find(parent);
+    if (it != _nodes.end())
+        it->offsets.clear();
+}
+
+QVector<double> TreeAggregator::contribution(const AbstractTreeItem *item) const
+{
+    return contribution(item, values(item));
+}
+
+int TreeAggregator::position(const AbstractTreeItem *item) const
+{
+    int position = -1;
+    for (; item->parent(); item = item->parent())
+        position += 1 + offset(item->parent(), item->row());
+    return position;
+}
+
+AbstractTreeItem *TreeAggregator::itemAt(AbstractTreeItem *root, int position) const
+{
+    if (position < 0)
+        return 0;
+
+    AbstractTreeItem *item = root;
+    while (position >= 0) {
+        int count = item->childCount();
+        if (position >= offset(item, count))
+            return 0;
+
+        // Offsets grow strictly, every child counts itself
+        const QVector<int> &offsets = _nodes[item].offsets;
+        int row = std::upper_bound(offsets.constBegin(), offsets.constBegin() + count, position)
+                - offsets.constBegin() - 1;
+        position -= offsets.at(row) + 1;
+        item = item->child(row);
+    }
+    return item;
+}
+
+// Children before their parent, items with pending children count them
+// without making them
+struct TreeAggregator::ComputeVisitor
+{
+    bool enter(AbstractTreeItem *item, int depth)
+    {
+        Q_UNUSED(depth)
+        return !item->hasPendingChildren();
+    }
+
+    void leave(AbstractTreeItem *item, int depth)
+    {
+        Q_UNUSED(depth)
+        aggregator->_nodes[item].offsets.clear();
+        aggregator->update(item);
+    }
+
+    const TreeAggregator *aggregator;
+};
+
+void TreeAggregator::compute(AbstractTreeItem *item) const
+{
+    ComputeVisitor visitor = { this };
+    visitTree(item, visitor);
+}
+
+void TreeAggregator::update(AbstractTreeItem *item) const
+{
+    if (item->hasPendingChildren()) {
+        QVector<double> result = item->pendingAggregates(*this);
+        _nodes[item].values = result;
+        return;
+    }
+
+    QVector<double> result = empty();
+    for (int row = 0; row < item->childCount(); ++row) {
+        const AbstractTreeItem *child = item->child(row);
+        QVector<double> childValues = values(child);
+        for (int slot = 0; slot < _aggregates.size(); ++slot) {
+            double value = contribution(child, slot, childValues.at(slot));
+            result[slot] = combined(_aggregates.at(slot).function, result.at(slot), value);
+        }
+    }
+    _nodes[item].values = result;
+}
+
+void TreeAggregator::forget(const QList<AbstractTreeItem*> &items)
+{
+    foreach (AbstractTreeItem *item, items) {
+        for (TreePreOrderIterator<AbstractTreeItem> it(item); it.item(); it.next()) {
+            _nodes.remove(it.item());
+            if (it.item()->hasPendingChildren())
+                it.skipChildren();
+        }
+    }
+}
+
+QVector<double> TreeAggregator::values(const AbstractTreeItem *item) const
+{
+    QHash<const AbstractTreeItem*, Node>::const_iterator it = _nodes.constFind(item);
+    return it == _nodes.constEnd() ? empty() : it->values;
+}
+
+void TreeAggregator::attach(AbstractTreeItem *parent, const QList<AbstractTreeItem*> &items,
+                            QList<AbstractTreeItem*> &changed) const
+{
+    if (items.isEmpty())
+        return;
+
+    QVector<double> after = empty();
+    foreach (AbstractTreeItem *item, items)
+        combine(after, contribution(item));
+    propagate(parent, items.first()->row(), empty(), after, changed);
+}
+
+void TreeAggregator::detach(AbstractTreeItem *parent, int row, const QList<AbstractTreeItem*> &items,
+                            QList<AbstractTreeItem*> &changed) const
+{
+    if (items.isEmpty())
+        return;
+
+    QVector<double> before = empty();
+    foreach (AbstractTreeItem *item, items)
+        combine(before, contribution(item));
+    propagate(parent, row, before, empty(), changed);
+}
+
+void TreeAggregator::propagate(AbstractTreeItem *parent, int row, QVector<double> before, QVector<double> after,
+                               QList<AbstractTreeItem*> &changed) const
+{
+    // before and after are what the child at row contributed to parent
+    while (parent) {
+        QVector<double> old = values(parent);
+        QVector<double> current = old;
+        bool lostExtreme = false;
+        for (int slot = 0; slot < _aggregates.size(); ++slot) {
+            double was = before.at(slot);
+            double is = after.at(slot);
+            double &value = current[slot];
+            if (isSame(was, is))
+                continue;
+
+            TreeAggregate::Function function = _aggregates.at(slot).function;
+            if (function == TreeAggregate::DescendantCount || function == TreeAggregate::Sum) {
+                value += is - was;
+            } else {
+                double best = combined(function, value, is);
+                if (!isSame(best, value))
+                    value = best;
+                else if (isSame(was, value))
+                    lostExtreme = true;
+            }
+        }
+
+        _nodes[parent].values = current;
+
+        // The child held the minimum or maximum, so the others decide now
+        if (lostExtreme)
+            update(parent);
+
+        Node &node = _nodes[parent];
+        if (old.at(0) != node.values.at(0) && node.offsets.size() > row + 1)
+            node.offsets.resize(row + 1);
+
+        before = contribution(parent, old);
+        after = contribution(parent);
+        if (std::equal(before.constBegin(), before.constEnd(), after.constBegin(), isSame))
+            return;
+
+        changed.append(parent);
+        row = parent->row();
+        parent = parent->parent();
+    }
+}
+
+QVector<double> TreeAggregator::contribution(const AbstractTreeItem *item, const QVector<double> &values) const
+{
+    QVector<double> result(values.size());
+    for (int slot = 0; slot < _aggregates.size(); ++slot)
+        result[slot] = contribution(item, slot, values.at(slot));
+    return result;
+}
+
+QVector<double> TreeAggregator::contribution(const QVector<double> &values, const QVector<double> &numbers) const
+{
+    QVector<double> result(values.size());
+    for (int slot = 0; slot < _aggregates.size(); ++slot)
+        result[slot] = contribution(slot, values.at(slot), numbers.at(slot));
+    return result;
+}
+
+double TreeAggregator::contribution(const AbstractTreeItem *item, int slot, double value) const
+{
+    // Counts don't look at the item's cells
+    const TreeAggregate &aggregate = _aggregates.at(slot);
+    if (aggregate.function <= TreeAggregate::Height)
+        return contribution(slot, value, qQNaN());
+    return contribution(slot, value, item->aggregateValue(aggregate.column));
+}
+
+double TreeAggregator::contribution(int slot, double value, double number) const
+{
+    // What an item with this aggregate adds to its parent's
+    const TreeAggregate &aggregate = _aggregates.at(slot);
+    switch (aggregate.function) {
+    case TreeAggregate::DescendantCount:
+    case TreeAggregate::Height:
+        return value + 1;
+    case TreeAggregate::Sum:
+        return qIsNaN(number) ? value : value + number;
+    case TreeAggregate::Minimum:
+    case TreeAggregate::Maximum:
+        return combined(aggregate.function, value, number);
+    }
+    return value;
+}
+
+QVector<double> TreeAggregator::empty() const
+{
+    QVector<double> values(_aggregates.size(), 0);
+    for (int slot = 0; slot < _aggregates.size(); ++slot) {
+        if (_aggregates.at(slot).function >= TreeAggregate::Minimum)
+            values[slot] = qQNaN();
+    }
+    return values;
+}
+
+void TreeAggregator::combine(QVector<double> &values, const QVector<double> &other) const
+{
+    for (int slot = 0; slot < _aggregates.size(); ++slot)
+        values[slot] = combined(_aggregates.at(slot).function, values.at(slot), other.at(slot));
+}
+
+int TreeAggregator::offset(const AbstractTreeItem *parent, int row) const
+{
+    // Extends the prefix sums of subtree sizes up to row. Children are
+    // made first, the table must not grow while offsets is in use.
+    parent->childCount();
+    QVector<int> &offsets = _nodes[parent].offsets;
+    if (offsets.isEmpty())
+        offsets.append(0);
+    for (int i = offsets.size() - 1; i < row; ++i)
+        offsets.append(offsets.at(i) + int(value(parent->child(i), 0)) + 1);
+    return offsets.at(row);
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <QHash>
+#include <QList>
+#include <QVector>
+
+class AbstractTreeItem;
+
+// Function of an item's descendants kept by TreeAggregator
+struct TreeAggregate
+{
+    enum Function
+    {
+        DescendantCount,
+        // Levels below the item, 0 for a leaf
+        Height,
+        // Over the numbers in a column, other cells are skipped
+        Sum,
+        Minimum,
+        Maximum
+    };
+
+    TreeAggregate(Function function = DescendantCount, int column = 0);
+
+    Function function;
+    int column;
+};
+
+// Keeps registered aggregates of every item in a tree up to date. Changes
+// travel up the ancestor path and stop at the first ancestor they leave
+// unchanged. Slot 0 always counts descendants, which also maps items to
+// and from their pre-order position in O(depth * log(children)). The
+// values live in a table of the aggregator's own, so items cost nothing
+// extra while no aggregate is registered.
+class TreeAggregator
+{
+public:
+    TreeAggregator();
+
+    // Returns the slot, an existing one if the aggregate is there already
+    int add(const TreeAggregate &aggregate);
+    int count() const;
+    TreeAggregate aggregate(int slot) const;
+
+    void rebuild(AbstractTreeItem *root);
+    double value(const AbstractTreeItem *item, int slot) const;
+
+    // Called after the change was made to the tree, return the ancestors
+    // whose aggregates changed
+    QList<AbstractTreeItem*> inserted(AbstractTreeItem *parent, const QList<AbstractTreeItem*> &items);
+    QList<AbstractTreeItem*> removed(AbstractTreeItem *parent, int row, const QList<AbstractTreeItem*> &items);
+    QList<AbstractTreeItem*> moved(AbstractTreeItem *from, int row, AbstractTreeItem *to,
+                                   const QList<AbstractTreeItem*> &items);
+    // before is contribution() of the item taken before its values changed
+    QList<AbstractTreeItem*> changed(AbstractTreeItem *item, const QVector<double> &before);
+    // The children of parent changed order
+    void reordered(const AbstractTreeItem *parent);
+    // Children an item made on demand, whose parent counts them already
+    void loaded(const QList<AbstractTreeItem*> &items);
+    QVector<double> contribution(const AbstractTreeItem *item) const;
+
+    int position(const AbstractTreeItem *item) const;
+    AbstractTreeItem *itemAt(AbstractTreeItem *root, int position) const;
+
+    // For AbstractTreeItem::pendingAggregates(): aggregates of an item
+    // without children, merging in what a child adds, and what an item
+    // adds to its parent given its aggregates and the number it holds in
+    // the column of each slot
+    QVector<double> empty() const;
+    void combine(QVector<double> &values, const QVector<double> &other) const;
+    QVector<double> contribution(const QVector<double> &values, const QVector<double> &numbers) const;
+
+private:
+    // Aggregates per slot and the pre-order offsets of the children,
+    // valid for the rows they cover
+    struct Node
+    {
+        QVector<double> values;
+        QVector<int> offsets;
+    };
+
+    struct ComputeVisitor;
+
+    void compute(AbstractTreeItem *item) const;
+    void update(AbstractTreeItem *item) const;
+    void forget(const QList<AbstractTreeItem*> &items);
+    QVector<double> values(const AbstractTreeItem *item) const;
+    void attach(AbstractTreeItem *parent, const QList<AbstractTreeItem*> &items,
+                QList<AbstractTreeItem*> &changed) const;
+    void detach(AbstractTreeItem *parent, int row, const QList<AbstractTreeItem*> &items,
+                QList<AbstractTreeItem*> &changed) const;
+    void propagate(AbstractTreeItem *parent, int row, QVector<double> before, QVector<double> after,
+                   QList<AbstractTreeItem*> &changed) const;
+    QVector<double> contribution(const AbstractTreeItem *item, const QVector<double> &values) const;
+    double contribution(const AbstractTreeItem *item, int slot, double value) const;
+    double contribution(int slot, double value, double number) const;
+    int offset(const AbstractTreeItem *parent, int row) const;
+
+    QVector<TreeAggregate> _aggregates;
+    mutable QHash<const AbstractTreeItem*, Node> _nodes;
+};
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <QList>
+
+class AbstractTreeItem;
+
+// Source of children for AbstractTreeModel items that are loaded on demand.
+// The model asks for the next page when a view wants to show more rows of
+// an item, so nothing below a collapsed item has to exist in memory.
+class TreeChildProvider
+{
+public:
+    virtual ~TreeChildProvider() {}
+
+    // Total number of children the source has for the item
+    virtual int childCount(const AbstractTreeItem *parent) const = 0;
+
+    // Creates up to count detached items for rows starting at first
+    virtual QList<AbstractTreeItem*> fetchChildren(const AbstractTreeItem *parent, int first, int count) = 0;
+};
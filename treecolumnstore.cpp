@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#include "treecolumnstore.h"
+
+#include <QtNumeric>
+
+TreeColumn::TreeColumn(const QString &name, Type type)
+    : name(name)
+    , type(type)
+{
+}
+
+TreeColumnStore::TreeColumnStore(const QVector<TreeColumn> &columns)
+    : _columns(columns)
+    , _data(columns.size())
+    , _slots(0)
+{
+    for (int column = 0; column < _columns.size(); ++column) {
+        if (_columns.at(column).type != TreeColumn::String)
+            _typed.append(column);
+    }
+}
+
+QVector<TreeColumn> TreeColumnStore::columns() const
+{
+    return _columns;
+}
+
+int TreeColumnStore::columnCount() const
+{
+    return _columns.size();
+}
+
+bool TreeColumnStore::isTyped(int column) const
+{
+    return column >= 0 && column < _columns.size() && _columns.at(column).type != TreeColumn::String;
+}
+
+bool TreeColumnStore::hasTypedColumns() const
+{
+    return !_typed.isEmpty();
+}
+
+quint32 TreeColumnStore::allocate()
+{
+    if (!_free.isEmpty())
+        return _free.takeLast();
+
+    foreach (int column, _typed) {
+        ColumnData &data = _data[column];
+        switch (_columns.at(column).type) {
+        case TreeColumn::Int64:
+            data.ints.append(0);
+            break;
+        case TreeColumn::Double:
+            data.doubles.append(0);
+            break;
+        case TreeColumn::Bool:
+            data.bools.append(0);
+            break;
+        case TreeColumn::String:
+            break;
+        }
+        data.set.append(0);
+    }
+    return _slots++;
+}
+
+void TreeColumnStore::release(quint32 slot)
+{
+    foreach (int column, _typed)
+        setText(slot, column, QString());
+    _free.append(slot);
+}
+
+int TreeColumnStore::slotCount() const
+{
+    return _slots;
+}
+
+bool TreeColumnStore::setText(quint32 slot, int column, const QString &text)
+{
+    ColumnData &data = _data[column];
+    bool ok = false;
+    switch (_columns.at(column).type) {
+    case TreeColumn::Int64: {
+        qint64 value = text.toLongLong(&ok);
+        data.ints[slot] = ok ? value : 0;
+        break;
+    }
+    case TreeColumn::Double: {
+        double value = text.toDouble(&ok);
+        data.doubles[slot] = ok ? value : 0;
+        break;
+    }
+    case TreeColumn::Bool:
+        if (text == QLatin1String("true") || text == QLatin1String("1")) {
+            data.bools[slot] = 1;
+            ok = true;
+        } else {
+            ok = text == QLatin1String("false") || text == QLatin1String("0");
+            data.bools[slot] = 0;
+        }
+        break;
+    case TreeColumn::String:
+        Q_ASSERT(false);
+        return false;
+    }
+
+    data.set[slot] = ok;
+    return ok || text.isEmpty();
+}
+
+bool TreeColumnStore::accepts(int column, const QString &text) const
+{
+    if (text.isEmpty())
+        return true;
+
+    bool ok = true;
+    switch (_columns.at(column).type) {
+    case TreeColumn::Int64:
+        text.toLongLong(&ok);
+        break;
+    case TreeColumn::Double:
+        text.toDouble(&ok);
+        break;
+    case TreeColumn::Bool:
+        ok = text == QLatin1String("true") || text == QLatin1String("1")
+            || text == QLatin1String("false") || text == QLatin1String("0");
+        break;
+    case TreeColumn::String:
+        break;
+    }
+    return ok;
+}
+
+double TreeColumnStore::parseNumber(int column, const QString &text) const
+{
+    bool ok = false;
+    double number = qQNaN();
+    switch (_columns.at(column).type) {
+    case TreeColumn::Int64:
+        number = double(text.toLongLong(&ok));
+        break;
+    case TreeColumn::Double:
+        number = text.toDouble(&ok);
+        break;
+    case TreeColumn::Bool:
+        ok = true;
+        if (text == QLatin1String("true") || text == QLatin1String("1"))
+            number = 1;
+        else if (text == QLatin1String("false") || text == QLatin1String("0"))
+            number = 0;
+        else
+            ok = false;
+        break;
+    case TreeColumn::String:
+        break;
+    }
+    return ok ? number : qQNaN();
+}
+
+QString TreeColumnStore::text(quint32 slot, int column) const
+{
+    const ColumnData &data = _data.at(column);
+    if (!data.set.at(slot))
+        return QString();
+
+    switch (_columns.at(column).type) {
+    case TreeColumn::Int64:
+        return QString::number(data.ints.at(slot));
+    case TreeColumn::Double: {
+        // Shortest of the two precisions that reads back the same number
+        QString text = QString::number(data.doubles.at(slot), 'g', 15);
+        if (text.toDouble() != data.doubles.at(slot))
+            text = QString::number(data.doubles.at(slot), 'g', 17);
+        return text;
+    }
+    case TreeColumn::Bool:
+        return data.bools.at(slot) ? QLatin1String("true") : QLatin1String("false");
+    case TreeColumn::String:
+        break;
+    }
+    return QString();
+}
+
+QVariant TreeColumnStore::value(quint32 slot, int column) const
+{
+    const ColumnData &data = _data.at(column);
+    if (!data.set.at(slot))
+        return QVariant();
+
+    switch (_columns.at(column).type) {
+    case TreeColumn::Int64:
+        return data.ints.at(slot);
+    case TreeColumn::Double:
+        return data.doubles.at(slot);
+    case TreeColumn::Bool:
+        return bool(data.bools.at(slot));
+    case TreeColumn::String:
+        break;
+    }
+    return QVariant();
+}
+
+double TreeColumnStore::number(quint32 slot, int column) const
+{
+    const ColumnData &data = _data.at(column);
+    if (!data.set.at(slot))
+        return qQNaN();
+
+    switch (_columns.at(column).type) {
+    case TreeColumn::Int64:
+        return double(data.ints.at(slot));
+    case TreeColumn::Double:
+        return data.doubles.at(slot);
+    case TreeColumn::Bool:
+        return data.bools.at(slot);
+    case TreeColumn::String:
+        break;
+    }
+    return qQNaN();
+}
+
+int TreeColumnStore::compare(quint32 left, quint32 right, int column) const
+{
+    const ColumnData &data = _data.at(column);
+    if (!data.set.at(left) || !data.set.at(right))
+        return int(data.set.at(left)) - int(data.set.at(right));
+
+    switch (_columns.at(column).type) {
+    case TreeColumn::Int64:
+        return data.ints.at(left) < data.ints.at(right) ? -1 : data.ints.at(right) < data.ints.at(left);
+    case TreeColumn::Double:
+        return data.doubles.at(left) < data.doubles.at(right) ? -1 : data.doubles.at(right) < data.doubles.at(left);
+    case TreeColumn::Bool:
+        return int(data.bools.at(left)) - int(data.bools.at(right));
+    case TreeColumn::String:
+        break;
+    }
+    return 0;
+}
+
+const qint64 *TreeColumnStore::int64Data(int column) const
+{
+    return _data.at(column).ints.constData();
+}
+
+const double *TreeColumnStore::doubleData(int column) const
+{
+    return _data.at(column).doubles.constData();
+}
+
+const quint8 *TreeColumnStore::boolData(int column) const
+{
+    return _data.at(column).bools.constData();
+}
+
+const quint8 *TreeColumnStore::setData(int column) const
+{
+    return _data.at(column).set.constData();
+}
+
+double TreeColumnStore::sum(int column) const
+{
+    // Unset cells are 0, so the loops need no branches
+    const ColumnData &data = _data.at(column);
+    double total = 0;
+    switch (_columns.at(column).type) {
+    case TreeColumn::Int64: {
+        const qint64 *values = data.ints.constData();
+        qint64 sum = 0;
+        for (int slot = 0; slot < _slots; ++slot)
+            sum += values[slot];
+        total = double(sum);
+        break;
+    }
+    case TreeColumn::Double: {
+        const double *values = data.doubles.constData();
+        for (int slot = 0; slot < _slots; ++slot)
+            total += values[slot];
+        break;
+    }
+    case TreeColumn::Bool: {
+        const quint8 *values = data.bools.constData();
+        int count = 0;
+        for (int slot = 0; slot < _slots; ++slot)
+            count += values[slot];
+        total = count;
+        break;
+    }
+    case TreeColumn::String:
+        break;
+    }
+    return total;
+}
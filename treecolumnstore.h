@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <QString>
+#include <QVariant>
+#include <QVector>
+
+// One column of a TreeModel
+struct TreeColumn
+{
+    enum Type
+    {
+        String,
+        Int64,
+        Double,
+        Bool
+    };
+
+    TreeColumn(const QString &name = QString(), Type type = String);
+
+    QString name;
+    Type type;
+};
+
+// Cells of the typed columns of a TreeModel, one contiguous vector per
+// column indexed by the slot of the item. String columns stay with the
+// items. Empty cells, cells that didn't parse and free slots hold 0 and are
+// marked unset, so a plain loop over a column sums it.
+class TreeColumnStore
+{
+public:
+    explicit TreeColumnStore(const QVector<TreeColumn> &columns);
+
+    QVector<TreeColumn> columns() const;
+    int columnCount() const;
+    bool isTyped(int column) const;
+    bool hasTypedColumns() const;
+
+    quint32 allocate();
+    void release(quint32 slot);
+    // Slots handed out so far, the length of every column vector
+    int slotCount() const;
+
+    // Parses text into the cell. Empty text unsets it, text that doesn't
+    // fit the column type unsets it and returns false.
+    bool setText(quint32 slot, int column, const QString &text);
+    // Whether setText() would take the text for the column
+    bool accepts(int column, const QString &text) const;
+    // Number the cell would hold after setText(), NaN when it would be unset
+    double parseNumber(int column, const QString &text) const;
+    QString text(quint32 slot, int column) const;
+    QVariant value(quint32 slot, int column) const;
+    double number(quint32 slot, int column) const;
+    // Unset cells sort first
+    int compare(quint32 left, quint32 right, int column) const;
+
+    // Column vectors for scans, slotCount() long
+    const qint64 *int64Data(int column) const;
+    const double *doubleData(int column) const;
+    const quint8 *boolData(int column) const;
+    const quint8 *setData(int column) const;
+    double sum(int column) const;
+
+private:
+    struct ColumnData
+    {
+        // Only the vector of the column's type is used
+        QVector<qint64> ints;
+        QVector<double> doubles;
+        QVector<quint8> bools;
+        QVector<quint8> set;
+    };
+
+    QVector<TreeColumn> _columns;
+    QVector<ColumnData> _data;
+    QVector<int> _typed;
+    QVector<quint32> _free;
+    int _slots;
+};
@@ -0,0 +1,330 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#include "treeexporter.h"
+#include "treeiterator.h"
+#include "treemodel.h"
+#include "treesnapshot.h"
+
+#include <QIODevice>
+#include <QPair>
+
+#include <cstring>
+
+namespace {
+
+const char *tsvEscape(char c)
+{
+    switch (c) {
+    case '\t': return "\\t";
+    case '\n': return "\\n";
+    case '\r': return "\\r";
+    case '\\': return "\\\\";
+    }
+    return 0;
+}
+
+const char *csvEscape(char c)
+{
+    return c == '"' ? "\"\"" : 0;
+}
+
+const char *jsonEscape(char c)
+{
+    static const char *const controls[] = {
+        "\\u0000", "\\u0001", "\\u0002", "\\u0003", "\\u0004", "\\u0005", "\\u0006", "\\u0007",
+        "\\b", "\\t", "\\n", "\\u000b", "\\f", "\\r", "\\u000e", "\\u000f",
+        "\\u0010", "\\u0011", "\\u0012", "\\u0013", "\\u0014", "\\u0015", "\\u0016", "\\u0017",
+        "\\u0018", "\\u0019", "\\u001a", "\\u001b", "\\u001c", "\\u001d", "\\u001e", "\\u001f"
+    };
+
+    if (c >= 0 && c < 0x20)
+        return controls[int(c)];
+    if (c == '"')
+        return "\\\"";
+    if (c == '\\')
+        return "\\\\";
+    return 0;
+}
+
+const char *noEscape(char)
+{
+    return 0;
+}
+
+// Encodes the UTF-16 value as UTF-8 straight into the buffer, only ASCII
+// characters are ever escaped. Unpaired surrogates become U+FFFD.
+void appendEscaped(QByteArray &buffer, const QString &value, const char *(*escape)(char))
+{
+    // Room for the longest escape per code unit, cut back at the end.
+    // Shrinking keeps the capacity, so the buffer is only grown once.
+    int size = buffer.size();
+    buffer.resize(size + 6 * value.size());
+    char *out = buffer.data() + size;
+    const ushort *in = value.utf16();
+    const ushort *end = in + value.size();
+    while (in != end) {
+        uint c = *in++;
+        if (c < 0x80) {
+            const char *replacement = escape(char(c));
+            if (!replacement) {
+                *out++ = char(c);
+                continue;
+            }
+            while (*replacement)
+                *out++ = *replacement++;
+        } else if (c < 0x800) {
+            *out++ = char(0xc0 | (c >> 6));
+            *out++ = char(0x80 | (c & 0x3f));
+        } else if (QChar::isHighSurrogate(c) && in != end && QChar::isLowSurrogate(*in)) {
+            c = QChar::surrogateToUcs4(ushort(c), *in++);
+            *out++ = char(0xf0 | (c >> 18));
+            *out++ = char(0x80 | ((c >> 12) & 0x3f));
+            *out++ = char(0x80 | ((c >> 6) & 0x3f));
+            *out++ = char(0x80 | (c & 0x3f));
+        } else {
+            if (QChar::isSurrogate(c))
+                c = QChar::ReplacementCharacter;
+            *out++ = char(0xe0 | (c >> 12));
+            *out++ = char(0x80 | ((c >> 6) & 0x3f));
+            *out++ = char(0x80 | (c & 0x3f));
+        }
+    }
+    buffer.resize(out - buffer.constData());
+}
+
+void appendCsv(QByteArray &buffer, const QString &value)
+{
+    bool quote = false;
+    foreach (QChar c, value) {
+        if (c == QLatin1Char(',') || c == QLatin1Char('"') || c == QLatin1Char('\n') || c == QLatin1Char('\r')) {
+            quote = true;
+            break;
+        }
+    }
+
+    if (!quote) {
+        appendEscaped(buffer, value, noEscape);
+        return;
+    }
+
+    buffer.append('"');
+    appendEscaped(buffer, value, csvEscape);
+    buffer.append('"');
+}
+
+void appendIndent(QByteArray &buffer, int width, char c = ' ')
+{
+    int size = buffer.size();
+    buffer.resize(size + width);
+    memset(buffer.data() + size, c, width);
+}
+
+}
+
+TreeExporter::TreeExporter(Format format)
+    : _format(format)
+    , _chunkSize(1 << 20)
+    , _device(0)
+    , _depth(-1)
+    , _ok(true)
+{
+}
+
+void TreeExporter::setFormat(Format format)
+{
+    _format = format;
+}
+
+TreeExporter::Format TreeExporter::format() const
+{
+    return _format;
+}
+
+void TreeExporter::setChunkSize(int bytes)
+{
+    _chunkSize = qMax(bytes, 1);
+}
+
+int TreeExporter::chunkSize() const
+{
+    return _chunkSize;
+}
+
+bool TreeExporter::write(QIODevice *device, const TreeModel *model, const QModelIndex &index)
+{
+    if (!device->isWritable())
+        return false;
+
+    begin(device);
+    TreePreOrderIterator<const AbstractTreeItem> it(model->itemFromIndex(index));
+    // The root item has no values of its own
+    int top = 0;
+    if (!index.isValid()) {
+        it.next();
+        top = 1;
+    }
+
+    for (; it.item() && _ok; it.next()) {
+        const TreeItem *item = static_cast<const TreeItem*>(it.item());
+        writeRecord(it.depth() - top, item->row(), item->values());
+    }
+    return end();
+}
+
+bool TreeExporter::write(QIODevice *device, const TreeSnapshot &snapshot)
+{
+    if (!device->isWritable())
+        return false;
+
+    // Snapshots don't know their parents, so the walk keeps the path
+    begin(device);
+    QVector<QPair<TreeSnapshot, int> > stack;
+    stack.append(qMakePair(snapshot, 0));
+    while (!stack.isEmpty() && _ok) {
+        QPair<TreeSnapshot, int> &top = stack.last();
+        if (top.second == top.first.childCount()) {
+            stack.removeLast();
+            continue;
+        }
+
+        int row = top.second++;
+        TreeSnapshot child = top.first.child(row);
+        writeRecord(stack.size() - 1, row, child.values());
+        if (child.childCount() > 0)
+            stack.append(qMakePair(child, 0));
+    }
+    return end();
+}
+
+void TreeExporter::begin(QIODevice *device)
+{
+    _device = device;
+    _buffer.clear();
+    _buffer.reserve(_chunkSize + 4096);
+    _path.clear();
+    _depth = -1;
+    _ok = true;
+
+    if (_format == Json)
+        _buffer.append('[');
+}
+
+void TreeExporter::writeRecord(int depth, int row, const QStringList &values)
+{
+    switch (_format) {
+    case IndentedTsv:
+        // Without the marker an empty first value would read as one more
+        // level of indent
+        appendIndent(_buffer, depth, '\t');
+        for (int i = 0; i < values.size(); ++i) {
+            if (i > 0)
+                _buffer.append('\t');
+            if (i == 0 && values.at(i).isEmpty())
+                _buffer.append("\\e");
+            else
+                appendEscaped(_buffer, values.at(i), tsvEscape);
+        }
+        _buffer.append('\n');
+        break;
+
+    case CsvWithPath:
+        _path.resize(depth + 1);
+        _path[depth] = row;
+        for (int i = 0; i <= depth; ++i) {
+            if (i > 0)
+                _buffer.append('/');
+            _buffer.append(QByteArray::number(_path.at(i)));
+        }
+        foreach (const QString &value, values) {
+            _buffer.append(',');
+            appendCsv(_buffer, value);
+        }
+        _buffer.append('\n');
+        break;
+
+    case Json:
+        // The previous object is still open, it either gets children or
+        // is closed along with the levels this record climbs out of
+        if (_depth < 0) {
+            _buffer.append('\n');
+        } else if (depth > _depth) {
+            _buffer.append(", \"children\": [\n");
+        } else {
+            _buffer.append('}');
+            for (int level = _depth; level > depth; --level) {
+                _buffer.append('\n');
+                appendIndent(_buffer, 2 * level);
+                _buffer.append("]}");
+            }
+            _buffer.append(",\n");
+        }
+
+        appendIndent(_buffer, 2 * (depth + 1));
+        _buffer.append("{\"values\": [");
+        for (int i = 0; i < values.size(); ++i) {
+            if (i > 0)
+                _buffer.append(", ");
+            _buffer.append('"');
+            appendEscaped(_buffer, values.at(i), jsonEscape);
+            _buffer.append('"');
+        }
+        _buffer.append(']');
+        break;
+    }
+
+    _depth = depth;
+    flush();
+}
+
+bool TreeExporter::end()
+{
+    if (_format == Json) {
+        if (_depth >= 0) {
+            _buffer.append('}');
+            for (int level = _depth; level > 0; --level) {
+                _buffer.append('\n');
+                appendIndent(_buffer, 2 * level);
+                _buffer.append("]}");
+            }
+            _buffer.append('\n');
+        }
+        _buffer.append("]\n");
+    }
+
+    flush(true);
+    _device = 0;
+    _buffer.clear();
+    return _ok;
+}
+
+void TreeExporter::flush(bool force)
+{
+    if (!_ok || (_buffer.size() < _chunkSize && !force))
+        return;
+
+    // resize() keeps the reserved chunk, clear() would free it
+    _ok = _device->write(_buffer) == _buffer.size();
+    _buffer.resize(0);
+}
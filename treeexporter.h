@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <QByteArray>
+#include <QModelIndex>
+#include <QStringList>
+#include <QVector>
+
+class QIODevice;
+class TreeModel;
+class TreeSnapshot;
+
+// Writes a subtree as text, one record per item in pre-order:
+//
+//   IndentedTsv  a tab per level, then the values separated by tabs, with
+//                \t, \n, \r and \\ escaped and an empty first value
+//                written as \e
+//   CsvWithPath  rows from the top of the export down to the item joined
+//                by '/', then the values (fields quoted with "" if needed)
+//   Json         nested [{"values": [...], "children": [...]}, ...]
+//
+// Output goes to the device in chunks of chunkSize() bytes and nothing else
+// is kept per item, so memory use doesn't depend on the size of the tree.
+class TreeExporter
+{
+public:
+    enum Format
+    {
+        IndentedTsv,
+        CsvWithPath,
+        Json
+    };
+
+    explicit TreeExporter(Format format = IndentedTsv);
+
+    void setFormat(Format format);
+    Format format() const;
+    void setChunkSize(int bytes);
+    int chunkSize() const;
+
+    // The item at index and everything below it, the whole model for an
+    // invalid index. Call it from the model's thread.
+    bool write(QIODevice *device, const TreeModel *model, const QModelIndex &index = QModelIndex());
+    // Everything below the snapshot, from any thread
+    bool write(QIODevice *device, const TreeSnapshot &snapshot);
+
+private:
+    void begin(QIODevice *device);
+    void writeRecord(int depth, int row, const QStringList &values);
+    bool end();
+    void flush(bool force = false);
+
+    Format _format;
+    int _chunkSize;
+
+    // State of the running write
+    QIODevice *_device;
+    QByteArray _buffer;
+    QVector<int> _path;
+    int _depth;
+    bool _ok;
+};
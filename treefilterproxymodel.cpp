@@ -0,0 +1,760 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#include "treefilterproxymodel.h"
+#include "abstracttreeitem.h"
+#include "abstracttreemodel.h"
+#include "treeiterator.h"
+
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+
+#include <algorithm>
+
+namespace {
+
+struct Frame
+{
+    AbstractTreeItem *item;
+    QModelIndex index;
+    int next;
+    int descendants;
+};
+
+}
+
+// Filters a range of top level subtrees on a pool thread
+class TreeFilterProxyModel::FilterTask : public QRunnable
+{
+public:
+    FilterTask(const TreeFilterProxyModel *model, int first, int end)
+        : done(0)
+        , _model(model)
+        , _first(first)
+        , _end(end)
+    {
+        setAutoDelete(false);
+    }
+
+    void run() override
+    {
+        for (int row = _first; row < _end; ++row)
+            _model->filterSubtree(QModelIndex(), row, entries);
+        if (done)
+            done->release();
+    }
+
+    QVector<NodeEntry> entries;
+    // Released once the task is done, when it runs on a pool thread
+    QSemaphore *done;
+
+private:
+    const TreeFilterProxyModel *_model;
+    int _first;
+    int _end;
+};
+
+TreeFilterProxyModel::TreeFilterProxyModel(QObject *parent)
+    : QAbstractProxyModel(parent)
+    , _source(0)
+    , _filterColumn(0)
+    , _filterRole(Qt::DisplayRole)
+    , _filterCaseSensitivity(Qt::CaseInsensitive)
+    , _parallel(true)
+    , _movedMatches(0)
+{
+}
+
+TreeFilterProxyModel::~TreeFilterProxyModel()
+{
+}
+
+void TreeFilterProxyModel::setSourceModel(QAbstractItemModel *sourceModel)
+{
+    beginResetModel();
+
+    if (_source)
+        disconnect(_source, 0, this, 0);
+
+    QAbstractProxyModel::setSourceModel(sourceModel);
+    _source = qobject_cast<AbstractTreeModel*>(sourceModel);
+    Q_ASSERT(!sourceModel || _source);
+    _states.clear();
+    _rows.clear();
+
+    if (_source) {
+        connect(_source, SIGNAL(dataChanged(QModelIndex,QModelIndex,QVector<int>)),
+                SLOT(sourceDataChanged(QModelIndex,QModelIndex)));
+        connect(_source, SIGNAL(rowsInserted(QModelIndex,int,int)),
+                SLOT(sourceRowsInserted(QModelIndex,int,int)));
+        connect(_source, SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)),
+                SLOT(sourceRowsAboutToBeRemoved(QModelIndex,int,int)));
+        connect(_source, SIGNAL(rowsRemoved(QModelIndex,int,int)),
+                SLOT(sourceRowsRemoved(QModelIndex,int,int)));
+        connect(_source, SIGNAL(rowsAboutToBeMoved(QModelIndex,int,int,QModelIndex,int)),
+                SLOT(sourceRowsAboutToBeMoved(QModelIndex,int,int)));
+        connect(_source, SIGNAL(rowsMoved(QModelIndex,int,int,QModelIndex,int)),
+                SLOT(sourceRowsMoved(QModelIndex,int,int,QModelIndex,int)));
+        connect(_source, SIGNAL(layoutAboutToBeChanged()), SLOT(sourceLayoutAboutToBeChanged()));
+        connect(_source, SIGNAL(layoutChanged()), SLOT(sourceLayoutChanged()));
+        connect(_source, SIGNAL(modelAboutToBeReset()), SLOT(sourceModelAboutToBeReset()));
+        connect(_source, SIGNAL(modelReset()), SLOT(sourceModelReset()));
+        connect(_source, SIGNAL(destroyed()), SLOT(sourceDestroyed()));
+        filterAll();
+    }
+
+    endResetModel();
+}
+
+QString TreeFilterProxyModel::filterString() const
+{
+    return _filter;
+}
+
+void TreeFilterProxyModel::setFilterString(const QString &pattern)
+{
+    if (pattern == _filter)
+        return;
+
+    // A longer pattern can only match nodes that match now
+    bool narrow = !_filter.isEmpty() && pattern.contains(_filter, _filterCaseSensitivity);
+
+    beginLayoutChange();
+    _filter = pattern;
+    if (narrow)
+        narrowFilter();
+    else
+        filterAll();
+    endLayoutChange();
+}
+
+void TreeFilterProxyModel::setFilterKeyColumn(int column)
+{
+    if (column == _filterColumn)
+        return;
+
+    _filterColumn = column;
+    invalidateFilter();
+}
+
+int TreeFilterProxyModel::filterKeyColumn() const
+{
+    return _filterColumn;
+}
+
+void TreeFilterProxyModel::setFilterRole(int role)
+{
+    if (role == _filterRole)
+        return;
+
+    _filterRole = role;
+    invalidateFilter();
+}
+
+int TreeFilterProxyModel::filterRole() const
+{
+    return _filterRole;
+}
+
+void TreeFilterProxyModel::setFilterCaseSensitivity(Qt::CaseSensitivity cs)
+{
+    if (cs == _filterCaseSensitivity)
+        return;
+
+    _filterCaseSensitivity = cs;
+    invalidateFilter();
+}
+
+Qt::CaseSensitivity TreeFilterProxyModel::filterCaseSensitivity() const
+{
+    return _filterCaseSensitivity;
+}
+
+void TreeFilterProxyModel::setParallelFiltering(bool enabled)
+{
+    _parallel = enabled;
+}
+
+bool TreeFilterProxyModel::isParallelFiltering() const
+{
+    return _parallel;
+}
+
+QModelIndex TreeFilterProxyModel::mapToSource(const QModelIndex &proxyIndex) const
+{
+    if (!_source || !proxyIndex.isValid())
+        return QModelIndex();
+
+    return _source->indexFromItem(sourceItem(proxyIndex), proxyIndex.column());
+}
+
+QModelIndex TreeFilterProxyModel::mapFromSource(const QModelIndex &sourceIndex) const
+{
+    if (!_source || !sourceIndex.isValid())
+        return QModelIndex();
+
+    AbstractTreeItem *item = static_cast<AbstractTreeItem*>(sourceIndex.internalPointer());
+    if (!isVisible(item))
+        return QModelIndex();
+
+    return proxyIndex(item, sourceIndex.column());
+}
+
+QModelIndex TreeFilterProxyModel::index(int row, int column, const QModelIndex &parent) const
+{
+    if (!_source || row < 0 || column < 0 || column >= columnCount(parent))
+        return QModelIndex();
+
+    AbstractTreeItem *parentItem = sourceItem(parent);
+    const QVector<int> &rows = visibleRows(parentItem);
+    if (row >= rows.size())
+        return QModelIndex();
+
+    return createIndex(row, column, parentItem->child(rows.at(row)));
+}
+
+QModelIndex TreeFilterProxyModel::parent(const QModelIndex &child) const
+{
+    if (!_source || !child.isValid())
+        return QModelIndex();
+
+    // Goes by the row lists only, so it stays right while rows are being
+    // inserted or removed
+    AbstractTreeItem *parentItem = sourceItem(child)->parent();
+    return parentItem ? proxyIndex(parentItem, 0) : QModelIndex();
+}
+
+int TreeFilterProxyModel::rowCount(const QModelIndex &parent) const
+{
+    if (!_source || parent.column() > 0)
+        return 0;
+
+    return visibleRows(sourceItem(parent)).size();
+}
+
+int TreeFilterProxyModel::columnCount(const QModelIndex &parent) const
+{
+    if (!_source)
+        return 0;
+
+    return _source->columnCount(mapToSource(parent));
+}
+
+bool TreeFilterProxyModel::hasChildren(const QModelIndex &parent) const
+{
+    if (!_source || parent.column() > 0)
+        return false;
+
+    if (_filter.isEmpty())
+        return _source->hasChildren(mapToSource(parent));
+
+    if (!parent.isValid())
+        return rowCount(parent) > 0;
+
+    return state(sourceItem(parent)).descendants > 0;
+}
+
+bool TreeFilterProxyModel::filterAcceptsItem(const QModelIndex &sourceIndex) const
+{
+    return _source->data(sourceIndex, _filterRole).toString().contains(_filter, _filterCaseSensitivity);
+}
+
+void TreeFilterProxyModel::sourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
+{
+    if (!topLeft.isValid())
+        return;
+
+    QModelIndex parent = topLeft.parent();
+    AbstractTreeItem *parentItem = _source->itemFromIndex(parent);
+
+    if (!_filter.isEmpty() && _filterColumn >= topLeft.column() && _filterColumn <= bottomRight.column()) {
+        for (int row = topLeft.row(); row <= bottomRight.row(); ++row) {
+            AbstractTreeItem *item = parentItem->child(row);
+            bool matches = filterAcceptsItem(_source->index(row, _filterColumn, parent));
+            NodeState old = state(item);
+            if (old.matches == matches)
+                continue;
+
+            bool wasVisible = isVisible(item);
+            if (matches || old.descendants > 0)
+                _states[item].matches = matches;
+            else
+                _states.remove(item);
+
+            AbstractTreeItem *top = wasVisible != isVisible(item) ? item : 0;
+            AbstractTreeItem *above = addMatches(parentItem, matches ? 1 : -1);
+            if (above)
+                top = above;
+            if (top)
+                setSubtreeVisible(top, isVisible(top));
+        }
+    }
+
+    // Forward the change for the rows that are shown
+    QHash<const AbstractTreeItem*, QVector<int> >::const_iterator it = _rows.constFind(parentItem);
+    if (it == _rows.constEnd())
+        return;
+
+    const QVector<int> &rows = it.value();
+    int first = std::lower_bound(rows.constBegin(), rows.constEnd(), topLeft.row()) - rows.constBegin();
+    int last = std::upper_bound(rows.constBegin(), rows.constEnd(), bottomRight.row()) - rows.constBegin() - 1;
+    if (first > last)
+        return;
+
+    emit dataChanged(createIndex(first, topLeft.column(), parentItem->child(rows.at(first))),
+                     createIndex(last, bottomRight.column(), parentItem->child(rows.at(last))));
+}
+
+void TreeFilterProxyModel::sourceRowsInserted(const QModelIndex &parent, int first, int last)
+{
+    AbstractTreeItem *parentItem = _source->itemFromIndex(parent);
+    int count = last - first + 1;
+
+    QHash<const AbstractTreeItem*, QVector<int> >::iterator it = _rows.find(parentItem);
+    if (it != _rows.end()) {
+        QVector<int> &rows = it.value();
+        for (int i = rows.size() - 1; i >= 0 && rows.at(i) >= first; --i)
+            rows[i] += count;
+    }
+
+    if (!_filter.isEmpty()) {
+        QVector<NodeEntry> entries;
+        int matches = 0;
+        for (int row = first; row <= last; ++row)
+            matches += filterSubtree(parent, row, entries);
+
+        if (matches == 0)
+            return;
+
+        foreach (const NodeEntry &entry, entries)
+            _states.insert(entry.first, entry.second);
+
+        // A parent that was hidden shows up together with the new rows
+        AbstractTreeItem *top = addMatches(parentItem, matches);
+        if (top) {
+            setSubtreeVisible(top, true);
+            return;
+        }
+    }
+
+    if (!_rows.contains(parentItem))
+        return;
+
+    QVector<int> shown;
+    for (int row = first; row <= last; ++row) {
+        if (isVisible(parentItem->child(row)))
+            shown.append(row);
+    }
+    if (shown.isEmpty())
+        return;
+
+    QModelIndex proxyParent = proxyIndex(parentItem, 0);
+    QVector<int> &rows = _rows[parentItem];
+    int pos = std::lower_bound(rows.begin(), rows.end(), first) - rows.begin();
+
+    beginInsertRows(proxyParent, pos, pos + shown.size() - 1);
+    rows.insert(pos, shown.size(), 0);
+    std::copy(shown.constBegin(), shown.constEnd(), rows.begin() + pos);
+    endInsertRows();
+}
+
+void TreeFilterProxyModel::sourceRowsAboutToBeRemoved(const QModelIndex &parent, int first, int last)
+{
+    AbstractTreeItem *parentItem = _source->itemFromIndex(parent);
+
+    int matches = 0;
+    for (int row = first; row <= last; ++row)
+        matches += matchCount(parentItem->child(row));
+
+    // A parent left without matches disappears with the rows
+    NodeState parentState = state(parentItem);
+    AbstractTreeItem *top = 0;
+    if (matches > 0 && parentItem->parent() && !parentState.matches && parentState.descendants == matches)
+        top = addMatches(parentItem, -matches);
+
+    if (top) {
+        setSubtreeVisible(top, false);
+    } else {
+        if (_rows.contains(parentItem)) {
+            QModelIndex proxyParent = proxyIndex(parentItem, 0);
+            QVector<int> &rows = _rows[parentItem];
+            int from = std::lower_bound(rows.begin(), rows.end(), first) - rows.begin();
+            int to = std::upper_bound(rows.begin(), rows.end(), last) - rows.begin();
+
+            if (from < to) {
+                QVector<int> removed = rows.mid(from, to - from);
+                beginRemoveRows(proxyParent, from, to - 1);
+                rows.remove(from, to - from);
+                endRemoveRows();
+
+                foreach (int row, removed)
+                    forgetRows(parentItem->child(row));
+            }
+        }
+
+        if (matches > 0)
+            addMatches(parentItem, -matches);
+    }
+
+    for (int row = first; row <= last; ++row)
+        forgetStates(parentItem->child(row));
+}
+
+void TreeFilterProxyModel::sourceRowsRemoved(const QModelIndex &parent, int first, int last)
+{
+    QHash<const AbstractTreeItem*, QVector<int> >::iterator it = _rows.find(_source->itemFromIndex(parent));
+    if (it == _rows.end())
+        return;
+
+    int count = last - first + 1;
+    QVector<int> &rows = it.value();
+    for (int i = rows.size() - 1; i >= 0 && rows.at(i) > last; --i)
+        rows[i] -= count;
+}
+
+void TreeFilterProxyModel::sourceRowsAboutToBeMoved(const QModelIndex &parent, int first, int last)
+{
+    beginLayoutChange();
+
+    // Counts move with the rows, the layout change takes care of the rest
+    AbstractTreeItem *parentItem = _source->itemFromIndex(parent);
+    _movedMatches = 0;
+    for (int row = first; row <= last; ++row)
+        _movedMatches += matchCount(parentItem->child(row));
+
+    if (_movedMatches > 0)
+        addMatches(parentItem, -_movedMatches);
+}
+
+void TreeFilterProxyModel::sourceRowsMoved(const QModelIndex &parent, int first, int last,
+                                           const QModelIndex &destination, int row)
+{
+    Q_UNUSED(parent)
+    Q_UNUSED(first)
+    Q_UNUSED(last)
+    Q_UNUSED(row)
+
+    if (_movedMatches > 0)
+        addMatches(_source->itemFromIndex(destination), _movedMatches);
+    _movedMatches = 0;
+
+    endLayoutChange();
+}
+
+void TreeFilterProxyModel::sourceLayoutAboutToBeChanged()
+{
+    beginLayoutChange();
+}
+
+void TreeFilterProxyModel::sourceLayoutChanged()
+{
+    endLayoutChange();
+}
+
+void TreeFilterProxyModel::sourceModelAboutToBeReset()
+{
+    beginResetModel();
+}
+
+void TreeFilterProxyModel::sourceModelReset()
+{
+    _rows.clear();
+    filterAll();
+    endResetModel();
+}
+
+void TreeFilterProxyModel::sourceDestroyed()
+{
+    beginResetModel();
+    _source = 0;
+    _states.clear();
+    _rows.clear();
+    endResetModel();
+}
+
+AbstractTreeItem *TreeFilterProxyModel::sourceItem(const QModelIndex &proxyIndex) const
+{
+    if (proxyIndex.isValid())
+        return static_cast<AbstractTreeItem*>(proxyIndex.internalPointer());
+
+    return _source->itemFromIndex(QModelIndex());
+}
+
+QModelIndex TreeFilterProxyModel::proxyIndex(AbstractTreeItem *item, int column) const
+{
+    AbstractTreeItem *parentItem = item->parent();
+    if (!parentItem)
+        return QModelIndex();
+
+    const QVector<int> &rows = visibleRows(parentItem);
+    int row = item->row();
+    QVector<int>::const_iterator pos = std::lower_bound(rows.constBegin(), rows.constEnd(), row);
+    if (pos == rows.constEnd() || *pos != row)
+        return QModelIndex();
+
+    return createIndex(pos - rows.constBegin(), column, item);
+}
+
+const QVector<int> &TreeFilterProxyModel::visibleRows(const AbstractTreeItem *parent) const
+{
+    QHash<const AbstractTreeItem*, QVector<int> >::iterator it = _rows.find(parent);
+    if (it != _rows.end())
+        return it.value();
+
+    QVector<int> rows;
+    if (_filter.isEmpty() || !parent->parent() || state(parent).descendants > 0) {
+        for (int row = 0; row < parent->childCount(); ++row) {
+            if (isVisible(parent->child(row)))
+                rows.append(row);
+        }
+    }
+    return _rows.insert(parent, rows).value();
+}
+
+TreeFilterProxyModel::NodeState TreeFilterProxyModel::state(const AbstractTreeItem *item) const
+{
+    NodeState none = { false, 0 };
+    return _states.value(item, none);
+}
+
+bool TreeFilterProxyModel::isVisible(const AbstractTreeItem *item) const
+{
+    if (_filter.isEmpty() || !item->parent())
+        return true;
+
+    NodeState itemState = state(item);
+    return itemState.matches || itemState.descendants > 0;
+}
+
+int TreeFilterProxyModel::matchCount(const AbstractTreeItem *item) const
+{
+    NodeState itemState = state(item);
+    return itemState.descendants + (itemState.matches ? 1 : 0);
+}
+
+void TreeFilterProxyModel::filterAll()
+{
+    _states.clear();
+    if (!_source || _filter.isEmpty())
+        return;
+
+    AbstractTreeItem *root = _source->itemFromIndex(QModelIndex());
+    int count = root->childCount();
+    if (count == 0)
+        return;
+
+    // Pool threads must only read the tree. Children still waiting in a
+    // snapshot are created and every row is numbered here beforehand.
+    for (TreePreOrderIterator<AbstractTreeItem> it(root); it.item(); it.next())
+        ;
+
+    int taskCount = _parallel ? qBound(1, QThread::idealThreadCount() * 4, count) : 1;
+    QList<FilterTask*> tasks;
+    for (int i = 0; i < taskCount; ++i)
+        tasks.append(new FilterTask(this, count * qint64(i) / taskCount, count * qint64(i + 1) / taskCount));
+
+    // The global pool is shared with other work, so only these tasks are
+    // waited for, and this thread takes the first one meanwhile
+    QSemaphore done;
+    for (int i = 1; i < tasks.size(); ++i) {
+        tasks.at(i)->done = &done;
+        QThreadPool::globalInstance()->start(tasks.at(i));
+    }
+    tasks.first()->run();
+    done.acquire(tasks.size() - 1);
+
+    foreach (FilterTask *task, tasks) {
+        foreach (const NodeEntry &entry, task->entries)
+            _states.insert(entry.first, entry.second);
+    }
+    qDeleteAll(tasks);
+}
+
+void TreeFilterProxyModel::narrowFilter()
+{
+    QList<const AbstractTreeItem*> candidates;
+    QHash<const AbstractTreeItem*, NodeState>::const_iterator it = _states.constBegin();
+    for (; it != _states.constEnd(); ++it) {
+        if (it.value().matches)
+            candidates.append(it.key());
+    }
+
+    _states.clear();
+    foreach (const AbstractTreeItem *candidate, candidates) {
+        AbstractTreeItem *item = const_cast<AbstractTreeItem*>(candidate);
+        if (!filterAcceptsItem(_source->indexFromItem(item, _filterColumn)))
+            continue;
+
+        _states[item].matches = true;
+        for (AbstractTreeItem *node = item->parent(); node && node->parent(); node = node->parent())
+            ++_states[node].descendants;
+    }
+}
+
+int TreeFilterProxyModel::filterSubtree(const QModelIndex &parent, int row, QVector<NodeEntry> &entries) const
+{
+    // Post-order walk, a node is done once all of its children are. The
+    // indexes are built from the rows walked, as asking an item for its
+    // row may renumber its siblings.
+    QVector<Frame> stack;
+    QModelIndex topIndex = _source->index(row, 0, parent);
+    Frame first = { _source->itemFromIndex(topIndex), topIndex, 0, 0 };
+    stack.append(first);
+
+    int total = 0;
+    while (!stack.isEmpty()) {
+        Frame &frame = stack.last();
+        if (frame.next < frame.item->childCount()) {
+            QModelIndex childIndex = _source->index(frame.next++, 0, frame.index);
+            Frame child = { _source->itemFromIndex(childIndex), childIndex, 0, 0 };
+            stack.append(child);
+            continue;
+        }
+
+        QModelIndex parentIndex = stack.size() > 1 ? stack.at(stack.size() - 2).index : parent;
+        QModelIndex filterIndex = _source->index(frame.index.row(), _filterColumn, parentIndex);
+        NodeState itemState = { filterAcceptsItem(filterIndex), frame.descendants };
+        int matches = itemState.descendants + (itemState.matches ? 1 : 0);
+        if (matches > 0)
+            entries.append(qMakePair(static_cast<const AbstractTreeItem*>(frame.item), itemState));
+
+        stack.removeLast();
+        if (stack.isEmpty())
+            total = matches;
+        else
+            stack.last().descendants += matches;
+    }
+    return total;
+}
+
+AbstractTreeItem *TreeFilterProxyModel::addMatches(AbstractTreeItem *item, int delta)
+{
+    // Nodes that change visibility form a chain from item upwards, the
+    // topmost of them is returned
+    AbstractTreeItem *top = 0;
+    for (AbstractTreeItem *node = item; node && node->parent(); node = node->parent()) {
+        bool wasVisible = isVisible(node);
+        NodeState &nodeState = _states[node];
+        nodeState.descendants += delta;
+        if (!nodeState.matches && nodeState.descendants == 0)
+            _states.remove(node);
+
+        if (wasVisible != isVisible(node))
+            top = node;
+    }
+    return top;
+}
+
+void TreeFilterProxyModel::setSubtreeVisible(AbstractTreeItem *item, bool visible)
+{
+    AbstractTreeItem *parentItem = item->parent();
+    if (!_rows.contains(parentItem))
+        return;
+
+    QModelIndex proxyParent = proxyIndex(parentItem, 0);
+    QVector<int> &rows = _rows[parentItem];
+    int row = item->row();
+    int pos = std::lower_bound(rows.begin(), rows.end(), row) - rows.begin();
+
+    if (visible) {
+        beginInsertRows(proxyParent, pos, pos);
+        rows.insert(pos, row);
+        endInsertRows();
+        return;
+    }
+
+    if (pos == rows.size() || rows.at(pos) != row)
+        return;
+
+    beginRemoveRows(proxyParent, pos, pos);
+    rows.remove(pos);
+    endRemoveRows();
+    forgetRows(item);
+}
+
+void TreeFilterProxyModel::forgetRows(const AbstractTreeItem *item)
+{
+    QList<const AbstractTreeItem*> pending;
+    pending.append(item);
+    while (!pending.isEmpty()) {
+        const AbstractTreeItem *node = pending.takeLast();
+        QHash<const AbstractTreeItem*, QVector<int> >::iterator it = _rows.find(node);
+        if (it == _rows.end())
+            continue;
+
+        foreach (int row, it.value())
+            pending.append(node->child(row));
+        _rows.erase(it);
+    }
+}
+
+void TreeFilterProxyModel::forgetStates(const AbstractTreeItem *item)
+{
+    QList<const AbstractTreeItem*> pending;
+    pending.append(item);
+    while (!pending.isEmpty()) {
+        const AbstractTreeItem *node = pending.takeLast();
+        QHash<const AbstractTreeItem*, NodeState>::iterator it = _states.find(node);
+        if (it == _states.end())
+            continue;
+
+        bool below = it.value().descendants > 0;
+        _states.erase(it);
+        for (int row = 0; below && row < node->childCount(); ++row)
+            pending.append(node->child(row));
+    }
+}
+
+void TreeFilterProxyModel::invalidateFilter()
+{
+    if (_filter.isEmpty())
+        return;
+
+    beginLayoutChange();
+    filterAll();
+    endLayoutChange();
+}
+
+void TreeFilterProxyModel::beginLayoutChange()
+{
+    emit layoutAboutToBeChanged();
+    _layoutIndexes = persistentIndexList();
+}
+
+void TreeFilterProxyModel::endLayoutChange()
+{
+    _rows.clear();
+
+    QModelIndexList indexes;
+    foreach (const QModelIndex &index, _layoutIndexes) {
+        AbstractTreeItem *item = sourceItem(index);
+        indexes.append(isVisible(item) ? proxyIndex(item, index.column()) : QModelIndex());
+    }
+    changePersistentIndexList(_layoutIndexes, indexes);
+    _layoutIndexes.clear();
+
+    emit layoutChanged();
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <QAbstractProxyModel>
+#include <QHash>
+#include <QPair>
+#include <QVector>
+
+class AbstractTreeItem;
+class AbstractTreeModel;
+
+// Filter proxy for AbstractTreeModel. A node is shown when it matches the
+// filter or has a matching descendant. Every node keeps whether it matches
+// and how many matches are below it, so a source change only walks the
+// path from the changed node to the root.
+class TreeFilterProxyModel : public QAbstractProxyModel
+{
+    Q_OBJECT
+
+public:
+    explicit TreeFilterProxyModel(QObject *parent = 0);
+    ~TreeFilterProxyModel() override;
+
+    void setSourceModel(QAbstractItemModel *sourceModel) override;
+
+    QString filterString() const;
+    void setFilterKeyColumn(int column);
+    int filterKeyColumn() const;
+    void setFilterRole(int role);
+    int filterRole() const;
+    void setFilterCaseSensitivity(Qt::CaseSensitivity cs);
+    Qt::CaseSensitivity filterCaseSensitivity() const;
+
+    // Top level subtrees are filtered on a thread pool, the source is
+    // only read while that happens
+    void setParallelFiltering(bool enabled);
+    bool isParallelFiltering() const;
+
+    QModelIndex mapToSource(const QModelIndex &proxyIndex) const override;
+    QModelIndex mapFromSource(const QModelIndex &sourceIndex) const override;
+
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+    QModelIndex parent(const QModelIndex &child) const override;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+
+public slots:
+    void setFilterString(const QString &pattern);
+
+protected:
+    // May run on pool threads when parallel filtering is enabled
+    virtual bool filterAcceptsItem(const QModelIndex &sourceIndex) const;
+
+private slots:
+    void sourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
+    void sourceRowsInserted(const QModelIndex &parent, int first, int last);
+    void sourceRowsAboutToBeRemoved(const QModelIndex &parent, int first, int last);
+    void sourceRowsRemoved(const QModelIndex &parent, int first, int last);
+    void sourceRowsAboutToBeMoved(const QModelIndex &parent, int first, int last);
+    void sourceRowsMoved(const QModelIndex &parent, int first, int last, const QModelIndex &destination, int row);
+    void sourceLayoutAboutToBeChanged();
+    void sourceLayoutChanged();
+    void sourceModelAboutToBeReset();
+    void sourceModelReset();
+    void sourceDestroyed();
+
+private:
+    class FilterTask;
+
+    struct NodeState
+    {
+        bool matches;
+        int descendants;
+    };
+    typedef QPair<const AbstractTreeItem*, NodeState> NodeEntry;
+
+    AbstractTreeItem *sourceItem(const QModelIndex &proxyIndex) const;
+    QModelIndex proxyIndex(AbstractTreeItem *item, int column) const;
+    const QVector<int> &visibleRows(const AbstractTreeItem *parent) const;
+    NodeState state(const AbstractTreeItem *item) const;
+    bool isVisible(const AbstractTreeItem *item) const;
+    int matchCount(const AbstractTreeItem *item) const;
+
+    void filterAll();
+    void narrowFilter();
+    int filterSubtree(const QModelIndex &parent, int row, QVector<NodeEntry> &entries) const;
+    AbstractTreeItem *addMatches(AbstractTreeItem *item, int delta);
+    void setSubtreeVisible(AbstractTreeItem *item, bool visible);
+    void forgetRows(const AbstractTreeItem *item);
+    void forgetStates(const AbstractTreeItem *item);
+    void invalidateFilter();
+    void beginLayoutChange();
+    void endLayoutChange();
+
+    AbstractTreeModel *_source;
+    QString _filter;
+    int _filterColumn;
+    int _filterRole;
+    Qt::CaseSensitivity _filterCaseSensitivity;
+    bool _parallel;
+
+    // Only nodes that match or have matches below are stored
+    QHash<const AbstractTreeItem*, NodeState> _states;
+    // Source rows of the shown children, built when a parent is first used
+    mutable QHash<const AbstractTreeItem*, QVector<int> > _rows;
+
+    QModelIndexList _layoutIndexes;
+    int _movedMatches;
+};
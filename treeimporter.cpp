@@ -0,0 +1,398 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#include "treeimporter.h"
+#include "treemodel.h"
+
+#include <QAtomicInt>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonParseError>
+#include <QMutex>
+#include <QQueue>
+#include <QSemaphore>
+#include <QThread>
+#include <QVector>
+
+namespace {
+
+const int MaxPendingChunks = 4;
+
+// Detached subtrees that attach to the same model parent
+struct ImportGroup
+{
+    int depth;
+    QList<AbstractTreeItem*> items;
+};
+
+struct ImportChunk
+{
+    ImportChunk()
+        : bytesRead(0)
+    {
+    }
+
+    ~ImportChunk()
+    {
+        foreach (const ImportGroup &group, groups) {
+            qDeleteAll(group.items);
+        }
+    }
+
+    QVector<ImportGroup> groups;
+    qint64 bytesRead;
+};
+
+bool parseCsv(const QByteArray &line, int &depth, QStringList &values)
+{
+    QString text = QString::fromUtf8(line);
+    QStringList fields;
+    QString field;
+    bool quoted = false;
+
+    for (int i = 0; i < text.size(); ++i) {
+        QChar c = text.at(i);
+        if (quoted) {
+            if (c != QLatin1Char('"'))
+                field += c;
+            else if (i + 1 < text.size() && text.at(i + 1) == QLatin1Char('"'))
+                field += text.at(++i);
+            else
+                quoted = false;
+        }
+        else if (c == QLatin1Char('"')) {
+            quoted = true;
+        }
+        else if (c == QLatin1Char(',')) {
+            fields.append(field);
+            field.clear();
+        }
+        else {
+            field += c;
+        }
+    }
+    fields.append(field);
+
+    if (quoted)
+        return false;
+
+    bool ok;
+    depth = fields.takeFirst().toInt(&ok);
+    values = fields;
+    return ok;
+}
+
+bool parseJsonLine(const QByteArray &line, int &depth, QStringList &values)
+{
+    QJsonParseError error;
+    QJsonDocument document = QJsonDocument::fromJson(line, &error);
+    if (error.error != QJsonParseError::NoError || !document.isObject())
+        return false;
+
+    QJsonObject object = document.object();
+    if (!object.value(QLatin1String("depth")).isDouble())
+        return false;
+
+    depth = object.value(QLatin1String("depth")).toInt();
+    values.clear();
+    QJsonArray array = object.value(QLatin1String("values")).toArray();
+    for (int i = 0; i < array.size(); ++i)
+        values.append(array.at(i).toString());
+    return true;
+}
+
+}
+
+// Shared between the importer and its worker thread
+class ImportState
+{
+public:
+    ImportState()
+        : freeSlots(MaxPendingChunks)
+        , bytesTotal(0)
+    {
+    }
+
+    ~ImportState()
+    {
+        qDeleteAll(chunks);
+    }
+
+    QMutex mutex;
+    QQueue<ImportChunk*> chunks;
+    QSemaphore freeSlots;
+    QAtomicInt canceled;
+    QString error;
+    qint64 bytesTotal;
+};
+
+class ImportThread : public QThread
+{
+public:
+    ImportThread(ImportState *state, QObject *receiver, const QString &fileName,
+                 TreeImporter::Format format, int chunkSize)
+        : _state(state)
+        , _receiver(receiver)
+        , _fileName(fileName)
+        , _format(format)
+        , _chunkSize(chunkSize)
+    {
+    }
+
+protected:
+    void run() override;
+
+private:
+    bool push(ImportChunk *chunk);
+
+    ImportState *_state;
+    QObject *_receiver;
+    QString _fileName;
+    TreeImporter::Format _format;
+    int _chunkSize;
+};
+
+void ImportThread::run()
+{
+    QFile file(_fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        _state->error = file.errorString();
+        return;
+    }
+
+    // Last item for every depth, or 0 once it was handed to the model
+    QVector<TreeItem*> open;
+    ImportChunk *chunk = new ImportChunk;
+    int records = 0;
+    int lineNumber = 0;
+
+    while (!file.atEnd() && !_state->canceled.load()) {
+        QByteArray line = file.readLine().trimmed();
+        ++lineNumber;
+        if (line.isEmpty())
+            continue;
+
+        int depth = 0;
+        QStringList values;
+        bool ok = _format == TreeImporter::Csv ? parseCsv(line, depth, values)
+                                               : parseJsonLine(line, depth, values);
+        if (!ok || depth < 0 || depth > open.size()) {
+            _state->error = QString("Malformed record at line %1").arg(lineNumber);
+            break;
+        }
+
+        TreeItem *item = new TreeItem(values);
+        TreeItem *parentItem = depth > 0 ? open.at(depth - 1) : 0;
+        if (parentItem) {
+            parentItem->appendChild(item);
+        }
+        else {
+            if (chunk->groups.isEmpty() || chunk->groups.last().depth != depth) {
+                ImportGroup group;
+                group.depth = depth;
+                chunk->groups.append(group);
+            }
+            chunk->groups.last().items.append(item);
+        }
+
+        open.resize(depth + 1);
+        open[depth] = item;
+
+        if (++records == _chunkSize) {
+            chunk->bytesRead = file.pos();
+            if (!push(chunk))
+                return;
+
+            chunk = new ImportChunk;
+            records = 0;
+            open.fill(0);
+        }
+    }
+
+    if (records > 0 && _state->error.isEmpty() && !_state->canceled.load()) {
+        chunk->bytesRead = file.pos();
+        push(chunk);
+    }
+    else {
+        delete chunk;
+    }
+}
+
+bool ImportThread::push(ImportChunk *chunk)
+{
+    // Blocks while the model is still busy with earlier chunks
+    _state->freeSlots.acquire();
+    if (_state->canceled.load()) {
+        delete chunk;
+        return false;
+    }
+
+    QMutexLocker locker(&_state->mutex);
+    _state->chunks.enqueue(chunk);
+    locker.unlock();
+
+    QMetaObject::invokeMethod(_receiver, "takeChunks", Qt::QueuedConnection);
+    return true;
+}
+
+TreeImporter::TreeImporter(TreeModel *model, QObject *parent)
+    : QObject(parent)
+    , _model(model)
+    , _chunkSize(10000)
+    , _state(0)
+    , _thread(0)
+    , _toRoot(true)
+{
+}
+
+TreeImporter::~TreeImporter()
+{
+    if (_thread) {
+        cancel();
+        _thread->wait();
+        delete _thread;
+    }
+    delete _state;
+}
+
+void TreeImporter::setChunkSize(int size)
+{
+    _chunkSize = qMax(size, 1);
+}
+
+int TreeImporter::chunkSize() const
+{
+    return _chunkSize;
+}
+
+bool TreeImporter::start(const QString &fileName, Format format, const QModelIndex &parent)
+{
+    if (_thread)
+        return false;
+
+    _state = new ImportState;
+    _state->bytesTotal = QFile(fileName).size();
+    _toRoot = !parent.isValid();
+    _target = parent;
+    _path.clear();
+
+    _thread = new ImportThread(_state, this, fileName, format, _chunkSize);
+    connect(_thread, SIGNAL(finished()), SLOT(threadFinished()));
+    _thread->start();
+    return true;
+}
+
+bool TreeImporter::isRunning() const
+{
+    return _thread != 0;
+}
+
+void TreeImporter::cancel()
+{
+    if (!_state)
+        return;
+
+    _state->canceled.store(1);
+    // Wake the worker up if it waits for a free slot
+    _state->freeSlots.release();
+}
+
+void TreeImporter::takeChunks()
+{
+    if (!_state)
+        return;
+
+    QMutexLocker locker(&_state->mutex);
+    QQueue<ImportChunk*> chunks;
+    chunks.swap(_state->chunks);
+    locker.unlock();
+
+    while (!chunks.isEmpty()) {
+        ImportChunk *chunk = chunks.dequeue();
+        bool targetGone = !_toRoot && !_target.isValid();
+
+        for (int i = 0; i < chunk->groups.size() && !_state->canceled.load() && !targetGone; ++i) {
+            ImportGroup &group = chunk->groups[i];
+
+            QModelIndex parent;
+            if (group.depth > 0) {
+                // The parent was removed from the model meanwhile
+                if (group.depth > _path.size() || !_path.at(group.depth - 1).isValid())
+                    continue;
+                parent = _path.at(group.depth - 1);
+            }
+            else {
+                parent = _target;
+            }
+
+            // The deepest last records are the attach points for the next
+            // chunk. They are taken from the items in file order, a model
+            // that keeps rows sorted may put them anywhere.
+            QList<AbstractTreeItem*> last;
+            AbstractTreeItem *item = group.items.isEmpty() ? 0 : group.items.last();
+            while (item) {
+                last.append(item);
+                item = item->childCount() > 0 ? item->child(item->childCount() - 1) : 0;
+            }
+
+            _model->addItems(group.items, parent);
+            group.items.clear();
+
+            while (_path.size() > group.depth)
+                _path.removeLast();
+            foreach (AbstractTreeItem *lastItem, last)
+                _path.append(_model->indexFromItem(lastItem));
+        }
+
+        if (!_state->canceled.load())
+            emit progress(chunk->bytesRead, _state->bytesTotal);
+
+        delete chunk;
+        _state->freeSlots.release();
+    }
+}
+
+void TreeImporter::threadFinished()
+{
+    takeChunks();
+
+    bool wasCanceled = _state->canceled.load();
+    QString error = _state->error;
+
+    _thread->wait();
+    delete _thread;
+    _thread = 0;
+    delete _state;
+    _state = 0;
+    _path.clear();
+
+    if (wasCanceled)
+        emit canceled();
+    else if (!error.isEmpty())
+        emit failed(error);
+    else
+        emit finished();
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <QList>
+#include <QObject>
+#include <QPersistentModelIndex>
+
+class ImportState;
+class ImportThread;
+class TreeModel;
+
+// Reads a hierarchy dump on a worker thread and feeds it to a TreeModel in
+// chunks. Records are in pre-order, one per line, and start with the depth
+// of the record below the import parent:
+//
+//   Csv        depth,value,value,...  (fields may be quoted with "")
+//   JsonLines  {"depth": 0, "values": ["value", ...]}
+//
+// Every chunk is inserted with one notification per parent it attaches
+// to. At most a few chunks are in flight at any time, so memory use does
+// not depend on the size of the input.
+class TreeImporter : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Format
+    {
+        Csv,
+        JsonLines
+    };
+
+    explicit TreeImporter(TreeModel *model, QObject *parent = 0);
+    ~TreeImporter() override;
+
+    void setChunkSize(int size);
+    int chunkSize() const;
+
+    bool start(const QString &fileName, Format format, const QModelIndex &parent = QModelIndex());
+    bool isRunning() const;
+
+public slots:
+    void cancel();
+
+signals:
+    void progress(qint64 bytesRead, qint64 bytesTotal);
+    void finished();
+    void canceled();
+    void failed(const QString &message);
+
+private slots:
+    void takeChunks();
+    void threadFinished();
+
+private:
+    TreeModel *_model;
+    int _chunkSize;
+
+    ImportState *_state;
+    ImportThread *_thread;
+
+    bool _toRoot;
+    QPersistentModelIndex _target;
+    QList<QPersistentModelIndex> _path;
+};
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#include "treeitempool.h"
+
+#include <QAtomicInt>
+#include <QMap>
+#include <QReadWriteLock>
+
+namespace {
+
+// Slabs of all pools by start address. Nodes may be deleted on any thread.
+struct SlabRegistry
+{
+    QReadWriteLock lock;
+    QMap<const char*, TreeItemPool*> slabs;
+    QAtomicInt count;
+};
+
+SlabRegistry &registry()
+{
+    static SlabRegistry slabs;
+    return slabs;
+}
+
+}
+
+TreeItemPool::TreeItemPool(size_t nodeSize, int nodesPerSlab)
+    : _nodeSize(qMax(nodeSize, sizeof(FreeNode)))
+    , _stride((_nodeSize + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*))
+    , _slabSize(_stride * qMax(nodesPerSlab, 1))
+    , _slabs(QList<char*>())
+    , _cursor(0)
+    , _end(0)
+    , _free(0)
+    , _live(0)
+{
+}
+
+TreeItemPool::~TreeItemPool()
+{
+    clear();
+}
+
+void *TreeItemPool::allocate()
+{
+    ++_live;
+
+    if (_free) {
+        FreeNode *node = _free;
+        _free = node->next;
+        return node;
+    }
+
+    if (_cursor == _end) {
+        char *slab = static_cast<char*>(::operator new(_slabSize));
+        _slabs.append(slab);
+        _cursor = slab;
+        _end = slab + _slabSize;
+
+        QWriteLocker locker(&registry().lock);
+        registry().slabs.insert(slab, this);
+        registry().count.ref();
+    }
+
+    void *node = _cursor;
+    _cursor += _stride;
+    return node;
+}
+
+void TreeItemPool::release(void *node)
+{
+    Q_ASSERT(owner(node) == this);
+
+    FreeNode *freeNode = static_cast<FreeNode*>(node);
+    freeNode->next = _free;
+    _free = freeNode;
+    --_live;
+}
+
+void TreeItemPool::clear()
+{
+    // The nodes' owners destroyed them already, slabs go back whole
+    Q_ASSERT(_live == 0);
+
+    if (!_slabs.isEmpty()) {
+        QWriteLocker locker(&registry().lock);
+        foreach (char *slab, _slabs) {
+            registry().slabs.remove(slab);
+            registry().count.deref();
+        }
+    }
+
+    foreach (char *slab, _slabs)
+        ::operator delete(slab);
+    _slabs.clear();
+    _cursor = 0;
+    _end = 0;
+    _free = 0;
+}
+
+void TreeItemPool::deallocate(void *node)
+{
+    TreeItemPool *pool = owner(node);
+    if (pool)
+        pool->release(node);
+    else
+        ::operator delete(node);
+}
+
+TreeItemPool *TreeItemPool::owner(const void *node)
+{
+    // With no pool in use heap nodes go straight back
+    SlabRegistry &slabs = registry();
+    if (slabs.count.load() == 0)
+        return 0;
+
+    const char *address = static_cast<const char*>(node);
+    QReadLocker locker(&slabs.lock);
+    QMap<const char*, TreeItemPool*>::const_iterator it = slabs.slabs.upperBound(address);
+    if (it == slabs.slabs.constBegin())
+        return 0;
+
+    --it;
+    TreeItemPool *pool = it.value();
+    return address < it.key() + pool->_slabSize ? pool : 0;
+}
+
+size_t TreeItemPool::nodeSize() const
+{
+    return _nodeSize;
+}
+
+int TreeItemPool::liveCount() const
+{
+    return _live;
+}
+
+int TreeItemPool::slabCount() const
+{
+    return _slabs.size();
+}
+
+qint64 TreeItemPool::reservedBytes() const
+{
+    return qint64(_slabs.size()) * _slabSize;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <QList>
+#include <QtGlobal>
+
+// Slab allocator for fixed size tree nodes. Freed nodes are kept on a free
+// list and reused, slabs are returned to the system by clear() and when the
+// pool is deleted. Slabs are registered by address, so a node can be given
+// back without knowing where it came from and heap nodes carry nothing
+// extra.
+class TreeItemPool
+{
+public:
+    explicit TreeItemPool(size_t nodeSize, int nodesPerSlab = 1024);
+    ~TreeItemPool();
+
+    void *allocate();
+    void release(void *node);
+    // Returns all slabs to the system, no node may be in use
+    void clear();
+
+    // Gives any node back to its pool, or to the heap when no pool's slab
+    // holds it. Only costs a lookup while some pool has slabs.
+    static void deallocate(void *node);
+    static TreeItemPool *owner(const void *node);
+
+    size_t nodeSize() const;
+    int liveCount() const;
+    int slabCount() const;
+    qint64 reservedBytes() const;
+
+private:
+    Q_DISABLE_COPY(TreeItemPool)
+
+    struct FreeNode
+    {
+        FreeNode *next;
+    };
+
+    size_t _nodeSize;
+    // Node padded to keep the next one aligned
+    size_t _stride;
+    size_t _slabSize;
+    QList<char*> _slabs;
+    char *_cursor;
+    char *_end;
+    FreeNode *_free;
+    int _live;
+};
@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include "abstracttreeitem.h"
+
+#include <QQueue>
+
+// Walks over AbstractTreeItem subtrees that need no recursion and no
+// memory of their own. They step along parent links and cached rows, so
+// the tree must not change while one of them is in use. Item is
+// AbstractTreeItem or a subclass, const or not.
+
+// Parents before their children
+template <typename Item>
+class TreePreOrderIterator
+{
+public:
+    explicit TreePreOrderIterator(Item *root)
+        : _root(root)
+        , _item(root)
+        , _depth(0)
+        , _skipChildren(false)
+    {
+    }
+
+    // 0 once the walk is over
+    Item *item() const { return _item; }
+    // Levels below the root
+    int depth() const { return _depth; }
+
+    // The next step leaves out the children of the current item
+    void skipChildren() { _skipChildren = true; }
+
+    void next()
+    {
+        bool down = !_skipChildren;
+        _skipChildren = false;
+        if (down && _item->childCount() > 0) {
+            _item = static_cast<Item*>(_item->child(0));
+            ++_depth;
+            return;
+        }
+
+        while (_item != _root) {
+            Item *parent = static_cast<Item*>(_item->parent());
+            int row = _item->row() + 1;
+            if (row < parent->childCount()) {
+                _item = static_cast<Item*>(parent->child(row));
+                return;
+            }
+            _item = parent;
+            --_depth;
+        }
+        _item = 0;
+    }
+
+private:
+    Item *_root;
+    Item *_item;
+    int _depth;
+    bool _skipChildren;
+};
+
+// Children before their parents, the root comes last
+template <typename Item>
+class TreePostOrderIterator
+{
+public:
+    explicit TreePostOrderIterator(Item *root)
+        : _root(root)
+        , _item(root)
+        , _depth(0)
+    {
+        descend();
+    }
+
+    Item *item() const { return _item; }
+    int depth() const { return _depth; }
+
+    void next()
+    {
+        if (_item == _root) {
+            _item = 0;
+            return;
+        }
+
+        Item *parent = static_cast<Item*>(_item->parent());
+        int row = _item->row() + 1;
+        if (row < parent->childCount()) {
+            _item = static_cast<Item*>(parent->child(row));
+            descend();
+        } else {
+            _item = parent;
+            --_depth;
+        }
+    }
+
+private:
+    void descend()
+    {
+        while (_item->childCount() > 0) {
+            _item = static_cast<Item*>(_item->child(0));
+            ++_depth;
+        }
+    }
+
+    Item *_root;
+    Item *_item;
+    int _depth;
+};
+
+// Level by level. Without a queue every level is found by walking the
+// levels above it again, so this costs O(items * height) where the other
+// walks cost O(items), which is no use on deep trees. Given a queue, that
+// the caller may reuse between walks, it costs O(items) and holds up to
+// one level of items in the queue.
+template <typename Item>
+class TreeBreadthFirstIterator
+{
+public:
+    explicit TreeBreadthFirstIterator(Item *root, QQueue<Item*> *queue = 0)
+        : _root(root)
+        , _item(root)
+        , _depth(0)
+        , _queue(queue)
+        , _levelLeft(0)
+        , _nextLevel(0)
+    {
+        if (_queue)
+            _queue->clear();
+    }
+
+    Item *item() const { return _item; }
+    int depth() const { return _depth; }
+
+    void next()
+    {
+        if (_queue) {
+            int count = _item->childCount();
+            for (int row = 0; row < count; ++row)
+                _queue->enqueue(static_cast<Item*>(_item->child(row)));
+            _nextLevel += count;
+
+            if (_queue->isEmpty()) {
+                _item = 0;
+                return;
+            }
+            if (_levelLeft == 0) {
+                ++_depth;
+                _levelLeft = _nextLevel;
+                _nextLevel = 0;
+            }
+            --_levelLeft;
+            _item = _queue->dequeue();
+            return;
+        }
+
+        Item *item = advance(_item, _depth, _depth);
+        if (!item) {
+            ++_depth;
+            item = advance(_root, 0, _depth);
+        }
+        _item = item;
+    }
+
+private:
+    // Next item at target depth after item in pre-order, never going
+    // below the target
+    Item *advance(Item *item, int depth, int target) const
+    {
+        bool down = depth < target;
+        for (;;) {
+            if (down && item->childCount() > 0) {
+                item = static_cast<Item*>(item->child(0));
+                ++depth;
+            } else {
+                for (;;) {
+                    if (item == _root)
+                        return 0;
+
+                    Item *parent = static_cast<Item*>(item->parent());
+                    int row = item->row() + 1;
+                    if (row < parent->childCount()) {
+                        item = static_cast<Item*>(parent->child(row));
+                        break;
+                    }
+                    item = parent;
+                    --depth;
+                }
+            }
+
+            if (depth == target)
+                return item;
+            down = true;
+        }
+    }
+
+    Item *_root;
+    Item *_item;
+    int _depth;
+    QQueue<Item*> *_queue;
+    // Items of the current level still in the queue, and of the next one
+    int _levelLeft;
+    int _nextLevel;
+};
+
+// Calls visitor.enter(item, depth) before the children of every item and
+// visitor.leave(item, depth) after them. Children are skipped when enter()
+// returns false, leave() is called anyway.
+template <typename Item, typename Visitor>
+void visitTree(Item *root, Visitor &visitor)
+{
+    Item *item = root;
+    int depth = 0;
+    for (;;) {
+        if (visitor.enter(item, depth) && item->childCount() > 0) {
+            item = static_cast<Item*>(item->child(0));
+            ++depth;
+            continue;
+        }
+
+        visitor.leave(item, depth);
+        for (;;) {
+            if (item == root)
+                return;
+
+            Item *parent = static_cast<Item*>(item->parent());
+            int row = item->row() + 1;
+            if (row < parent->childCount()) {
+                item = static_cast<Item*>(parent->child(row));
+                break;
+            }
+            item = parent;
+            --depth;
+            visitor.leave(item, depth);
+        }
+    }
+}
@@ -24,171 +24,2136 @@
  */
 
 #include "treemodel.h"
+#include "treeaggregate.h"
+#include "treeitempool.h"
+#include "treeiterator.h"
+#include "treemodelstats.h"
+#include "stringpool.h"
+#include "treesearchindex.h"
+#include "treeundolog.h"
 
 #include <QDebug>
+#include <QFile>
+#include <QHash>
+#include <QMimeData>
+#include <QPair>
+#include <QPointer>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QSemaphore>
+#include <QSet>
+#include <QThread>
+#include <QThreadPool>
+#include <QTimer>
+#include <QtNumeric>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Binary tree file layout, all integers in host byte order:
+//
+//   header        FileHeader
+//   nodes         pre-order, root first: child count, value count and
+//                 one string table index per value, all quint32
+//   string table  per string: quint32 length in UTF-16 code units,
+//                 the code units, padding to 4 bytes
+const quint32 TreeFileMagic = 0x4C444D54;
+const quint32 TreeFileVersion = 1;
+const quint32 TreeFileByteOrder = 0x01020304;
+
+struct FileHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint32 byteOrder;
+    quint32 stringCount;
+    quint64 nodeCount;
+    quint64 stringTableOffset;
+};
+
+const int WriteChunkSize = 1 << 20;
+
+void appendUInt32(QByteArray &buffer, quint32 value)
+{
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void appendString(QByteArray &buffer, const QString &string)
+{
+    appendUInt32(buffer, string.size());
+    buffer.append(reinterpret_cast<const char*>(string.constData()), string.size() * sizeof(QChar));
+    if (string.size() % 2)
+        buffer.append(QByteArray(sizeof(QChar), '\0'));
+}
+
+bool flushChunk(QIODevice *device, QByteArray &buffer, qint64 &written, bool force = false)
+{
+    if (buffer.size() < WriteChunkSize && !force)
+        return true;
+
+    bool ok = device->write(buffer) == buffer.size();
+    written += buffer.size();
+    buffer.clear();
+    return ok;
+}
+
+// Same layout as TreeModel::save(), with the subtrees as the root's
+// children
+QByteArray encodeTree(const QVector<TreeSnapshot> &subtrees)
+{
+    FileHeader header = { TreeFileMagic, TreeFileVersion, TreeFileByteOrder, 0, 0, 0 };
+    QByteArray buffer;
+    buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    appendUInt32(buffer, subtrees.size());
+    appendUInt32(buffer, 0);
+
+    QHash<QString, quint32> stringIds;
+    QVector<QString> strings;
+
+    // Snapshots have no parent links, so the walk keeps its own stack of
+    // the next row to visit per level
+    QVector<QPair<TreeSnapshot, int> > stack;
+    stack.append(qMakePair(TreeSnapshot(QStringList(), subtrees), 0));
+    while (!stack.isEmpty()) {
+        QPair<TreeSnapshot, int> &top = stack.last();
+        if (top.second == top.first.childCount()) {
+            stack.removeLast();
+            continue;
+        }
+
+        TreeSnapshot node = top.first.child(top.second++);
+        QStringList values = node.values();
+        appendUInt32(buffer, node.childCount());
+        appendUInt32(buffer, values.size());
+        foreach (const QString &value, values) {
+            QHash<QString, quint32>::const_iterator id = stringIds.constFind(value);
+            if (id == stringIds.constEnd()) {
+                id = stringIds.insert(value, strings.size());
+                strings.append(value);
+            }
+            appendUInt32(buffer, id.value());
+        }
+        ++header.nodeCount;
+
+        if (node.childCount() > 0)
+            stack.append(qMakePair(node, 0));
+    }
+
+    header.stringTableOffset = buffer.size();
+    header.stringCount = strings.size();
+    foreach (const QString &string, strings)
+        appendString(buffer, string);
+
+    memcpy(buffer.data(), &header, sizeof(header));
+    return buffer;
+}
+
+const char TreeMimeType[] = "application/x-treemodel-subtrees";
+
+// Dragged or copied rows. Persistent indexes let the source model splice
+// them on a move, snapshots keep what was copied for any other target.
+// The snapshots are taken when somebody first asks for them, or by the
+// model right before it changes, and the tree file encoding only when
+// somebody asks for the data.
+class TreeMimeData : public QMimeData
+{
+public:
+    TreeMimeData(const TreeModel *model, const QList<QPersistentModelIndex> &indexes)
+        : _model(model)
+        , _indexes(indexes)
+        , _frozen(false)
+    {
+    }
+
+    const TreeModel *model() const { return _model; }
+    QList<QPersistentModelIndex> indexes() const { return _indexes; }
+    QVector<TreeSnapshot> subtrees() const
+    {
+        freeze();
+        return _subtrees;
+    }
+
+    void freeze() const
+    {
+        if (_frozen)
+            return;
+
+        _frozen = true;
+        foreach (const QPersistentModelIndex &index, _indexes) {
+            if (index.isValid())
+                _subtrees.append(static_cast<TreeItem*>(index.internalPointer())->uncachedSnapshot());
+        }
+    }
+
+    QStringList formats() const override
+    {
+        return QStringList() << QLatin1String(TreeMimeType);
+    }
+
+protected:
+    QVariant retrieveData(const QString &mimeType, QVariant::Type type) const override
+    {
+        if (mimeType != QLatin1String(TreeMimeType))
+            return QMimeData::retrieveData(mimeType, type);
+
+        if (_encoded.isEmpty())
+            _encoded = encodeTree(subtrees());
+        return _encoded;
+    }
+
+private:
+    QPointer<const TreeModel> _model;
+    QList<QPersistentModelIndex> _indexes;
+    mutable bool _frozen;
+    mutable QVector<TreeSnapshot> _subtrees;
+    mutable QByteArray _encoded;
+};
+
+// Rows leading from an ancestor down to an item, used to put search hits
+// into tree order
+typedef QPair<QVector<int>, const TreeItem*> TreePosition;
+
+bool lessPosition(const TreePosition &left, const TreePosition &right)
+{
+    return std::lexicographical_compare(left.first.constBegin(), left.first.constEnd(),
+                                        right.first.constBegin(), right.first.constEnd());
+}
+
+// An edited row waiting for its dataChanged
+struct EditedRow
+{
+    AbstractTreeItem *parent;
+    int row;
+    int firstColumn;
+    int lastColumn;
+    TreeItem *item;
+};
+
+bool lessEditedRow(const EditedRow &left, const EditedRow &right)
+{
+    if (left.parent != right.parent)
+        return left.parent < right.parent;
+    return left.row < right.row;
+}
+
+QVector<TreeColumn> defaultColumns()
+{
+    QVector<TreeColumn> columns;
+    for (int column = 0; column < 3; ++column)
+        columns.append(TreeColumn(QString("Column %1").arg(column)));
+    return columns;
+}
+
+// Below this many children in total sort() stays on the calling thread
+const qint64 ParallelSortThreshold = 10000;
+
+struct SortEntry
+{
+    QString key;
+    quint32 slot;
+    AbstractTreeItem *item;
+};
+
+// Compares the string keys, or the cells of a typed column by slot
+struct EntryLess
+{
+    bool operator()(const SortEntry &left, const SortEntry &right) const
+    {
+        int result = store ? store->compare(left.slot, right.slot, column) : QString::compare(left.key, right.key);
+        return descending ? result > 0 : result < 0;
+    }
+
+    const TreeColumnStore *store;
+    int column;
+    bool descending;
+};
+
+// Works out the new order of a batch of sibling groups. Only reads the
+// items, the orders are applied afterwards on the model's thread.
+class SortTask : public QRunnable
+{
+public:
+    SortTask(int column, Qt::SortOrder order, const TreeColumnStore *store)
+        : done(0)
+        , _column(column)
+        , _order(order)
+        , _store(store)
+    {
+        setAutoDelete(false);
+    }
+
+    void run() override
+    {
+        QVector<SortEntry> entries;
+        foreach (const AbstractTreeItem *parent, parents) {
+            entries.clear();
+            entries.reserve(parent->childCount());
+            for (int row = 0; row < parent->childCount(); ++row) {
+                const TreeItem *child = static_cast<const TreeItem*>(parent->child(row));
+                SortEntry entry = { _store ? QString() : child->value(_column), child->slot(), parent->child(row) };
+                entries.append(entry);
+            }
+
+            EntryLess less = { _store, _column, _order == Qt::DescendingOrder };
+            std::stable_sort(entries.begin(), entries.end(), less);
+
+            QList<AbstractTreeItem*> order;
+            order.reserve(entries.size());
+            foreach (const SortEntry &entry, entries)
+                order.append(entry.item);
+            orders.append(order);
+        }
+        if (done)
+            done->release();
+    }
+
+    QList<AbstractTreeItem*> parents;
+    QList<QList<AbstractTreeItem*> > orders;
+    // Set for tasks handed to the pool, released when run() is through
+    QSemaphore *done;
+
+private:
+    int _column;
+    Qt::SortOrder _order;
+    // Set when the column is typed
+    const TreeColumnStore *_store;
+};
+
+// Snapshot node on the way through its children and the aggregates over
+// the ones done
+struct SnapshotFrame
+{
+    TreeSnapshot node;
+    int row;
+    QVector<double> values;
+};
+
+}
 
 TreeItem::TreeItem(const QStringList &values, AbstractTreeItem *parent)
     : AbstractTreeItem(parent)
     , _values(values)
+    , _store(0)
+    , _slot(0)
+    , _childrenPending(false)
 {
 }
 
 TreeItem::~TreeItem()
 {
+    if (_store)
+        _store->release(_slot);
 }
 
-void TreeItem::setValue(int column, const QString &name)
+void *TreeItem::operator new(size_t size)
+{
+    return ::operator new(size);
+}
+
+void *TreeItem::operator new(size_t size, TreeItemPool *pool)
+{
+    // Pool nodes are only pointer aligned
+    Q_STATIC_ASSERT(Q_ALIGNOF(TreeItem) <= sizeof(void*));
+    if (pool && size <= pool->nodeSize())
+        return pool->allocate();
+
+    return ::operator new(size);
+}
+
+void TreeItem::operator delete(void *ptr)
+{
+    // The pools know their slabs, anything else came from the heap
+    TreeItemPool::deallocate(ptr);
+}
+
+void TreeItem::operator delete(void *ptr, TreeItemPool *pool)
 {
-    while (column >= _values.size())
-        _values << "";
+    Q_UNUSED(pool)
+    TreeItem::operator delete(ptr);
+}
 
-    _values[column] = name;
+void TreeItem::setValue(int column, const QString &name)
+{
+    if (_store && _store->isTyped(column)) {
+        _store->setText(_slot, column, name);
+    } else {
+        while (column >= _values.size())
+            _values << "";
+        _values[column] = name;
+    }
+    invalidateSnapshot();
 }
 
 QString TreeItem::value(int column) const
 {
+    if (_store && _store->isTyped(column))
+        return _store->text(_slot, column);
     return column < _values.size() ? _values.at(column) : "";
 }
 
+QVariant TreeItem::data(int column) const
+{
+    if (_store && _store->isTyped(column))
+        return _store->value(_slot, column);
+    return value(column);
+}
+
 void TreeItem::setValues(const QStringList &values)
 {
     _values = values;
+    if (_store)
+        moveToStore();
+    invalidateSnapshot();
 }
 
 QStringList TreeItem::values() const
 {
-    return _values;
+    if (!_store || !_store->hasTypedColumns())
+        return _values;
+
+    QStringList values = _values;
+    for (int column = 0; column < _store->columnCount(); ++column) {
+        if (!_store->isTyped(column))
+            continue;
+        while (column >= values.size())
+            values << "";
+        values[column] = _store->text(_slot, column);
+    }
+    return values;
+}
+
+void TreeItem::attach(TreeColumnStore *store)
+{
+    if (_store == store)
+        return;
+    if (_store)
+        detach();
+
+    _store = store;
+    _slot = store->allocate();
+    moveToStore();
+}
+
+void TreeItem::detach()
+{
+    if (!_store)
+        return;
+
+    _values = values();
+    _store->release(_slot);
+    _store = 0;
+}
+
+TreeColumnStore *TreeItem::store() const
+{
+    return _store;
+}
+
+quint32 TreeItem::slot() const
+{
+    return _slot;
+}
+
+void TreeItem::moveToStore()
+{
+    // Typed cells only live in the store, the list keeps empty places.
+    // Parsing can change how a cell reads, "1.50" comes back as 1.5 and
+    // text that isn't a number as nothing, and snapshots must read the same.
+    bool changed = false;
+    for (int column = 0; column < _store->columnCount(); ++column) {
+        if (!_store->isTyped(column))
+            continue;
+
+        QString text;
+        if (column < _values.size()) {
+            text = _values.at(column);
+            _values[column] = QString();
+        }
+        _store->setText(_slot, column, text);
+        if (!changed && _store->text(_slot, column) != text)
+            changed = true;
+    }
+
+    if (changed)
+        invalidateSnapshot();
+}
+
+// Builds missing snapshots children first and stops at cached ones. The
+// last childCount() built snapshots are the children of the item left.
+struct TreeItem::SnapshotVisitor
+{
+    bool enter(const TreeItem *item, int depth)
+    {
+        Q_UNUSED(depth)
+        return item->_snapshot.isNull();
+    }
+
+    void leave(const TreeItem *item, int depth)
+    {
+        Q_UNUSED(depth)
+        if (!item->_snapshot.isNull()) {
+            built.append(item->_snapshot);
+            return;
+        }
+
+        int first = built.size() - item->childCount();
+        TreeSnapshot snapshot(item->values(), built.mid(first));
+        built.resize(first);
+        built.append(snapshot);
+        if (cache)
+            item->_snapshot = snapshot;
+    }
+
+    bool cache;
+    QVector<TreeSnapshot> built;
+};
+
+TreeSnapshot TreeItem::snapshot() const
+{
+    if (_snapshot.isNull()) {
+        SnapshotVisitor visitor;
+        visitor.cache = true;
+        visitTree(this, visitor);
+    }
+    return _snapshot;
+}
+
+TreeSnapshot TreeItem::uncachedSnapshot() const
+{
+    if (!_snapshot.isNull())
+        return _snapshot;
+
+    SnapshotVisitor visitor;
+    visitor.cache = false;
+    visitTree(this, visitor);
+    return visitor.built.last();
+}
+
+bool TreeItem::hasSnapshot() const
+{
+    return !_snapshot.isNull();
+}
+
+TreeItem *TreeItem::fromSnapshot(const TreeSnapshot &snapshot)
+{
+    TreeItem *item = new TreeItem(snapshot.values());
+    item->setLazySnapshot(snapshot);
+    return item;
 }
 
 TreeItem *TreeItem::clone() const
 {
-    TreeItem *newItem = new TreeItem;
-    newItem->_values = _values;
+    // Shares the subtree with this item, the copy creates its own
+    // children only when somebody looks at them
+    return fromSnapshot(uncachedSnapshot());
+}
+
+bool TreeItem::hasPendingChildren() const
+{
+    return _childrenPending;
+}
+
+double TreeItem::aggregateValue(int column) const
+{
+    if (_store && _store->isTyped(column))
+        return _store->number(_slot, column);
 
-    foreach (AbstractTreeItem *child, children()) {
-        newItem->appendChild(child->clone());
+    bool ok;
+    double number = value(column).toDouble(&ok);
+    return ok ? number : qQNaN();
+}
+
+QVector<double> TreeItem::pendingAggregates(const TreeAggregator &aggregator) const
+{
+    // Post-order over the snapshot, a node's aggregates are what its
+    // children add to them
+    QVector<double> numbers(aggregator.count());
+    QVector<SnapshotFrame> stack;
+    SnapshotFrame top = { _snapshot, 0, aggregator.empty() };
+    stack.append(top);
+    for (;;) {
+        SnapshotFrame &frame = stack.last();
+        if (frame.row < frame.node.childCount()) {
+            SnapshotFrame child = { frame.node.child(frame.row++), 0, aggregator.empty() };
+            stack.append(child);
+            continue;
+        }
+
+        SnapshotFrame done = stack.last();
+        stack.removeLast();
+        if (stack.isEmpty())
+            return done.values;
+
+        for (int slot = 0; slot < numbers.size(); ++slot) {
+            TreeAggregate aggregate = aggregator.aggregate(slot);
+            numbers[slot] = aggregate.function >= TreeAggregate::Sum
+                ? number(done.node.value(aggregate.column), aggregate.column)
+                : qQNaN();
+        }
+        aggregator.combine(stack.last().values, aggregator.contribution(done.values, numbers));
     }
-    return newItem;
 }
 
 QString TreeItem::toString() const
 {
-    return _values.join(" ");
+    return values().join(" ");
+}
+
+void TreeItem::loadChildren() const
+{
+    // An empty list only means unloaded children while the flag says so,
+    // items that lost their children keep their snapshot until the
+    // change reaches childrenChanged()
+    if (!_childrenPending)
+        return;
+    _childrenPending = false;
+
+    const TreeItem *top = this;
+    while (top->parent())
+        top = static_cast<const TreeItem*>(top->parent());
+
+    QList<AbstractTreeItem*> items;
+    items.reserve(_snapshot.childCount());
+    for (int row = 0; row < _snapshot.childCount(); ++row)
+        items.append(top->createChild(_snapshot.child(row)));
+    const_cast<TreeItem*>(this)->adoptChildren(items);
+
+    // The children hold the parts of it they need now
+    _snapshot = TreeSnapshot();
+    top->childrenCreated(const_cast<TreeItem*>(this), items);
+}
+
+void TreeItem::childrenChanged()
+{
+    invalidateSnapshot();
+}
+
+TreeItem *TreeItem::createChild(const TreeSnapshot &snapshot) const
+{
+    return fromSnapshot(snapshot);
+}
+
+void TreeItem::childrenCreated(TreeItem *parent, const QList<AbstractTreeItem*> &items) const
+{
+    Q_UNUSED(parent)
+    Q_UNUSED(items)
+}
+
+void TreeItem::invalidateSnapshot()
+{
+    // Children still to be made live only in the snapshot
+    if (hasPendingChildren())
+        childCount();
+
+    // Items that made their children let go of their snapshot while the
+    // ones above keep theirs, so this goes all the way up
+    for (AbstractTreeItem *item = this; item; item = item->parent())
+        static_cast<TreeItem*>(item)->_snapshot = TreeSnapshot();
+}
+
+void TreeItem::setLazySnapshot(const TreeSnapshot &snapshot)
+{
+    // Leaves have nothing to make later and share their values anyway
+    if (snapshot.childCount() == 0)
+        return;
+
+    _snapshot = snapshot;
+    _childrenPending = true;
+}
+
+void TreeItem::internValues(StringPool *strings)
+{
+    // Interning keeps the text, snapshots stay valid
+    _values = strings->intern(_values);
+}
+
+double TreeItem::number(const QString &text, int column) const
+{
+    if (_store && _store->isTyped(column))
+        return _store->parseNumber(column, text);
+
+    bool ok;
+    double number = text.toDouble(&ok);
+    return ok ? number : qQNaN();
 }
 
+// Makes the children of lazy copies in the model from its pools and keeps
+// its bookkeeping of them
+class TreeModel::RootItem : public TreeItem
+{
+public:
+    explicit RootItem(TreeModel *model)
+        : _model(model)
+    {
+    }
+
+private:
+    TreeItem *createChild(const TreeSnapshot &snapshot) const override
+    {
+        return _model->itemFromSnapshot(snapshot);
+    }
+
+    void childrenCreated(TreeItem *parent, const QList<AbstractTreeItem*> &items) const override
+    {
+        _model->childrenCreated(parent, items);
+    }
+
+    TreeModel *_model;
+};
+
 TreeModel::TreeModel(QObject *parent)
-    : AbstractTreeModel(new TreeItem, parent)
+    : AbstractTreeModel(new RootItem(this), parent)
+    , _pool(0)
+    , _poolEnabled(false)
+    , _strings(0)
+    , _releasedStrings(0)
+    , _unindexedSubtrees(0)
+    , _sortColumn(-1)
+    , _sortOrder(Qt::AscendingOrder)
+    , _keepSorted(false)
+    , _transactionDepth(0)
+    , _commitTimer(0)
+    , _undo(0)
+    , _replaying(false)
+    , _snapshotVersion(0)
+    , _columns(new TreeColumnStore(defaultColumns()))
 {
+    // Copied rows keep what they were at the time of the copy
+    connect(this, SIGNAL(rowsAboutToBeInserted(QModelIndex,int,int)), SLOT(freezeMimeData()));
+    connect(this, SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)), SLOT(freezeMimeData()));
+    connect(this, SIGNAL(rowsAboutToBeMoved(QModelIndex,int,int,QModelIndex,int)), SLOT(freezeMimeData()));
+    connect(this, SIGNAL(layoutAboutToBeChanged()), SLOT(freezeMimeData()));
+    connect(this, SIGNAL(modelAboutToBeReset()), SLOT(freezeMimeData()));
 }
 
 TreeModel::~TreeModel()
 {
+    // The clipboard may outlive the model
+    freezeMimeData();
+
+    // Pooled items must go before the pool does, parked ones included
+    delete _undo;
+    qDeleteAll(root()->takeChildren(0, root()->childCount()));
+    delete _pool;
+    delete _strings;
+    qDeleteAll(_searchIndexes);
+    delete _columns;
 }
 
 void TreeModel::add(const QStringList &values, const QModelIndex &index)
 {
-    beginInsertRows(index, rowCount(index), rowCount(index));
-    TreeItem *item;
-    if (index.isValid())
-        item = static_cast<TreeItem*>(index.internalPointer());
-    else
-        item = static_cast<TreeItem*>(root());
+    TREEMODEL_PROBE(Add);
 
-    new TreeItem(values, item);
-    endInsertRows();
+    appendItems(QList<AbstractTreeItem*>() << createItem(values), index);
 }
 
-void TreeModel::remove(const QModelIndex &index)
+void TreeModel::addMany(const QVector<QStringList> &values, const QModelIndex &index)
 {
-    TreeItem *item = static_cast<TreeItem*>(index.internalPointer());
-    if (item == root() || !item)
+    TREEMODEL_PROBE(AddMany);
+
+    if (values.isEmpty())
         return;
 
-    beginRemoveRows(index.parent(), item->row(), item->row());
-    delete item;
-    endRemoveRows();
+    QList<AbstractTreeItem*> items;
+    items.reserve(values.size());
+    foreach (const QStringList &rowValues, values) {
+        items.append(createItem(rowValues));
+    }
+
+    appendItems(items, index);
 }
 
-void TreeModel::up(const QModelIndex &index)
+void TreeModel::addItems(const QList<AbstractTreeItem*> &items, const QModelIndex &index)
 {
-    TreeItem *item = static_cast<TreeItem*>(index.internalPointer());
-    if (!item || root() == item)
+    if (items.isEmpty())
         return;
 
-    if (index.row() == 0)
-        return;
+    // Lazy copies intern their children when they make them
+    if (_strings) {
+        foreach (AbstractTreeItem *item, items) {
+            for (TreePreOrderIterator<TreeItem> it(static_cast<TreeItem*>(item)); it.item(); it.next()) {
+                it.item()->internValues(_strings);
+                if (it.item()->hasPendingChildren())
+                    it.skipChildren();
+            }
+        }
+    }
+
+    // Sorting reads typed cells from the store
+    attachItems(items);
+    if (isKeptSorted())
+        sortItems(items);
 
-    beginMoveRows(index.parent(), index.row(), index.row(), index.parent(), index.row() - 1);
-    item->setRow(index.row() - 1);
-    endMoveRows();
+    appendItems(items, index);
 }
 
-void TreeModel::down(const QModelIndex &index)
+void TreeModel::remove(const QModelIndex &index)
 {
+    TREEMODEL_PROBE(Remove);
+
     TreeItem *item = static_cast<TreeItem*>(index.internalPointer());
-    if (!item || root() == item)
+    if (item == root() || !item)
         return;
 
-    if (index.row() + 1 == rowCount(index.parent()))
-        return;
+    removeRows(item->row(), 1, index.parent());
+}
 
-    beginMoveRows(index.parent(), index.row(), index.row(), index.parent(), index.row() + 2);
-    item->setRow(index.row() + 1);
-    endMoveRows();
+void TreeModel::clear()
+{
+    beginResetModel();
+    clearUndo();
+    qDeleteAll(root()->takeChildren(0, root()->childCount()));
+    // Items hold strings and children, so they are still destroyed one by
+    // one, but the slabs go back to the system at once
+    if (_pool && !_pool->liveCount())
+        _pool->clear();
+    if (_strings)
+        _strings->clear();
+    _releasedStrings = 0;
+    foreach (TreeSearchIndex *index, _searchIndexes)
+        index->clear();
+    _unindexedSubtrees = 0;
+    _pendingEdits.clear();
+    rebuildAggregates();
+    endResetModel();
 }
 
-int TreeModel::columnCount(const QModelIndex &parent) const
+void TreeModel::setNodePoolEnabled(bool enabled)
 {
-    Q_UNUSED(parent)
-    return 3;
+    // The pool stays alive while it still owns items
+    if (enabled && !_pool)
+        _pool = new TreeItemPool(sizeof(TreeItem));
+
+    _poolEnabled = enabled;
 }
 
-QVariant TreeModel::data(const QModelIndex &index, int role) const
+bool TreeModel::isNodePoolEnabled() const
 {
-    if (!index.isValid())
-        return QVariant();
+    return _poolEnabled;
+}
 
-    if (role == Qt::DisplayRole || role == Qt::EditRole) {
-        TreeItem *node = static_cast<TreeItem*>(index.internalPointer());
-        return node->value(index.column());
+const TreeItemPool *TreeModel::nodePool() const
+{
+    return _pool;
+}
+
+void TreeModel::setStringPoolEnabled(bool enabled)
+{
+    if (enabled && !_strings)
+        _strings = new StringPool;
+
+    if (!enabled) {
+        delete _strings;
+        _strings = 0;
     }
+}
 
-    return QVariant();
+bool TreeModel::isStringPoolEnabled() const
+{
+    return _strings != 0;
 }
 
-bool TreeModel::setData(const QModelIndex &index, const QVariant &value, int role)
+const StringPool *TreeModel::stringPool() const
 {
-    if (!index.isValid())
-        return false;
+    return _strings;
+}
 
-    if (role != Qt::EditRole && role != Qt::CheckStateRole && role < Qt::UserRole)
-        return false;
+void TreeModel::setColumns(const QVector<TreeColumn> &columns)
+{
+    beginResetModel();
+    clearUndo();
 
-    if (role == Qt::EditRole) {
-        TreeItem *node = static_cast<TreeItem*>(index.internalPointer());
-        node->setValue(index.column(), value.toString());
-        emit dataChanged(index, index);
-        return true;
-    }
+    // Typed cells go back to the items as strings and are parsed again
+    // for the new types
+    detachItems(root()->children());
+    delete _columns;
+    _columns = new TreeColumnStore(columns);
+    attachItems(root()->children());
 
-    return false;
+    // Parsed cells may read differently now
+    foreach (TreeSearchIndex *index, _searchIndexes)
+        index->clear();
+    _unindexedSubtrees = 0;
+    indexItems(root()->children());
+    rebuildAggregates();
+
+    if (_sortColumn >= columns.size())
+        _sortColumn = -1;
+    if (_sortColumn >= 0)
+        sortItems(QList<AbstractTreeItem*>() << root());
+    _pendingEdits.clear();
+    endResetModel();
 }
 
-QVariant TreeModel::headerData(int section, Qt::Orientation orientation, int role) const
+QVector<TreeColumn> TreeModel::columns() const
 {
-    if (orientation == Qt::Orientation::Horizontal && role == Qt::DisplayRole) {
-        return QString("Column %1").arg(section);
-    }
-    else {
-        return AbstractTreeModel::headerData(section, orientation, role);
+    return _columns->columns();
+}
+
+const TreeColumnStore *TreeModel::columnStore() const
+{
+    return _columns;
+}
+
+void TreeModel::setIndexedColumns(const QList<int> &columns)
+{
+    qDeleteAll(_searchIndexes);
+    _searchIndexes.clear();
+    foreach (int column, columns) {
+        if (column >= 0 && !searchIndex(column))
+            _searchIndexes.append(new TreeSearchIndex(column));
     }
+    _unindexedSubtrees = 0;
+
+    indexItems(root()->children());
 }
 
-Qt::ItemFlags TreeModel::flags(const QModelIndex &index) const
+QList<int> TreeModel::indexedColumns() const
 {
-    if (!index.isValid())
-        return AbstractTreeModel::flags(index);
+    QList<int> columns;
+    foreach (TreeSearchIndex *index, _searchIndexes)
+        columns.append(index->column());
+    return columns;
+}
 
-    Qt::ItemFlags f = Qt::ItemIsSelectable | Qt::ItemIsEnabled | Qt::ItemIsEditable;
+void TreeModel::beginTransaction()
+{
+    ++_transactionDepth;
+    beginUndoStep();
+}
+
+void TreeModel::commitTransaction()
+{
+    Q_ASSERT(_transactionDepth > 0);
+    endUndoStep();
+    if (--_transactionDepth > 0)
+        return;
+
+    // A running commit timer announces the edits when it fires
+    if (!_commitTimer || !_commitTimer->isActive())
+        commitEdits();
+}
+
+void TreeModel::setMaxCommitRate(int commitsPerSecond)
+{
+    if (commitsPerSecond <= 0) {
+        delete _commitTimer;
+        _commitTimer = 0;
+        if (_transactionDepth == 0)
+            commitEdits();
+        return;
+    }
+
+    if (!_commitTimer) {
+        _commitTimer = new QTimer(this);
+        _commitTimer->setSingleShot(true);
+        connect(_commitTimer, SIGNAL(timeout()), SLOT(commitEdits()));
+    }
+    _commitTimer->setInterval(qMax(1, 1000 / commitsPerSecond));
+}
+
+int TreeModel::maxCommitRate() const
+{
+    return _commitTimer ? 1000 / _commitTimer->interval() : 0;
+}
+
+void TreeModel::setUndoLimit(int steps)
+{
+    if (steps <= 0) {
+        delete _undo;
+        _undo = 0;
+    } else if (_undo) {
+        _undo->setLimit(steps);
+    } else {
+        _undo = new TreeUndoLog(steps);
+    }
+}
+
+int TreeModel::undoLimit() const
+{
+    return _undo ? _undo->limit() : 0;
+}
+
+bool TreeModel::canUndo() const
+{
+    return _undo && _undo->canUndo() && _transactionDepth == 0;
+}
+
+bool TreeModel::canRedo() const
+{
+    return _undo && _undo->canRedo() && _transactionDepth == 0;
+}
+
+bool TreeModel::undo()
+{
+    if (!canUndo())
+        return false;
+
+    TreeUndoStep &step = _undo->nextUndo();
+    _replaying = true;
+    beginTransaction();
+    for (int i = step.size() - 1; i >= 0; --i)
+        replay(step[i], false);
+    commitTransaction();
+    _replaying = false;
+    _undo->undone();
+    return true;
+}
+
+bool TreeModel::redo()
+{
+    if (!canRedo())
+        return false;
+
+    TreeUndoStep &step = _undo->nextRedo();
+    _replaying = true;
+    beginTransaction();
+    for (int i = 0; i < step.size(); ++i)
+        replay(step[i], true);
+    commitTransaction();
+    _replaying = false;
+    _undo->redone();
+    return true;
+}
+
+void TreeModel::clearUndo()
+{
+    if (_undo)
+        _undo->clear();
+}
+
+TreeSnapshot TreeModel::snapshot() const
+{
+    // Changes drop the cached snapshots up to the root
+    const TreeItem *rootItem = static_cast<const TreeItem*>(root());
+    if (!rootItem->hasSnapshot())
+        ++_snapshotVersion;
+    return rootItem->snapshot();
+}
+
+quint64 TreeModel::snapshotVersion() const
+{
+    return _snapshotVersion;
+}
+
+QStringList TreeModel::mimeTypes() const
+{
+    return QStringList() << QLatin1String(TreeMimeType);
+}
+
+QMimeData *TreeModel::mimeData(const QModelIndexList &indexes) const
+{
+    // One entry per row, and none for rows below another dragged row
+    QSet<AbstractTreeItem*> selected;
+    foreach (const QModelIndex &index, indexes) {
+        if (index.isValid())
+            selected.insert(item(index));
+    }
+
+    QList<QPersistentModelIndex> rows;
+    QSet<AbstractTreeItem*> added;
+    foreach (const QModelIndex &index, indexes) {
+        AbstractTreeItem *node = index.isValid() ? item(index) : 0;
+        if (!node || added.contains(node))
+            continue;
+
+        AbstractTreeItem *ancestor = node->parent();
+        while (ancestor && !selected.contains(ancestor))
+            ancestor = ancestor->parent();
+        if (ancestor)
+            continue;
+
+        added.insert(node);
+        rows.append(QPersistentModelIndex(indexFromItem(node)));
+    }
+
+    if (rows.isEmpty())
+        return 0;
+
+    for (int i = _mimeData.size() - 1; i >= 0; --i) {
+        if (!_mimeData.at(i))
+            _mimeData.removeAt(i);
+    }
+
+    // Snapshots wait until they are needed, which a move inside the
+    // model never does
+    TreeMimeData *data = new TreeMimeData(this, rows);
+    _mimeData.append(data);
+    return data;
+}
+
+void TreeModel::freezeMimeData()
+{
+    foreach (const QPointer<QMimeData> &data, _mimeData) {
+        if (data)
+            static_cast<TreeMimeData*>(data.data())->freeze();
+    }
+    _mimeData.clear();
+}
+
+bool TreeModel::dropMimeData(const QMimeData *data, Qt::DropAction action, int row, int column,
+                             const QModelIndex &parent)
+{
+    Q_UNUSED(column)
+
+    if (!data || (action != Qt::CopyAction && action != Qt::MoveAction))
+        return false;
+    if (row > rowCount(parent))
+        row = -1;
+
+    const TreeMimeData *treeData = dynamic_cast<const TreeMimeData*>(data);
+    if (treeData && treeData->model() == this && action == Qt::MoveAction) {
+        // The rows are in place once spliced, and a view that saw the
+        // drop succeed would remove the source rows after it. The move
+        // itself must not freeze the data it carries.
+        for (int i = _mimeData.size() - 1; i >= 0; --i) {
+            if (_mimeData.at(i).data() == treeData)
+                _mimeData.removeAt(i);
+        }
+        moveDropped(treeData->indexes(), row, parent);
+        return false;
+    }
+
+    QList<AbstractTreeItem*> items;
+    if (treeData) {
+        // Copies share the snapshots and create their children on first
+        // use, from the model's pools like everything else
+        foreach (const TreeSnapshot &subtree, treeData->subtrees())
+            items.append(itemFromSnapshot(subtree));
+    } else {
+        if (!data->hasFormat(QLatin1String(TreeMimeType)))
+            return false;
+
+        // The reader takes the items from the pools
+        QByteArray encoded = data->data(QLatin1String(TreeMimeType));
+        TreeItem staging;
+        if (!readTree(encoded.constData(), encoded.size(), &staging))
+            return false;
+        items = staging.takeChildren(0, staging.childCount());
+    }
+
+    if (items.isEmpty())
+        return false;
+
+    insertDropped(items, row, parent);
+    return true;
+}
+
+Qt::DropActions TreeModel::supportedDropActions() const
+{
+    return Qt::CopyAction | Qt::MoveAction;
+}
+
+bool TreeModel::save(QIODevice *device) const
+{
+    if (!device->isWritable() || device->isSequential())
+        return false;
+
+    qint64 start = device->pos();
+    FileHeader header = { TreeFileMagic, TreeFileVersion, TreeFileByteOrder, 0, 0, 0 };
+
+    QByteArray buffer;
+    buffer.reserve(WriteChunkSize + 1024);
+    buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    qint64 written = 0;
+
+    QHash<QString, quint32> stringIds;
+    QVector<QString> strings;
+
+    // Pre-order walk, every item is written when it is first reached
+    appendUInt32(buffer, root()->childCount());
+    appendUInt32(buffer, 0);
+
+    TreePreOrderIterator<const TreeItem> it(static_cast<const TreeItem*>(root()));
+    for (it.next(); it.item(); it.next()) {
+        const TreeItem *item = it.item();
+        QStringList values = item->values();
+        appendUInt32(buffer, item->childCount());
+        appendUInt32(buffer, values.size());
+        foreach (const QString &value, values) {
+            QHash<QString, quint32>::const_iterator id = stringIds.constFind(value);
+            if (id == stringIds.constEnd()) {
+                id = stringIds.insert(value, strings.size());
+                strings.append(value);
+            }
+            appendUInt32(buffer, id.value());
+        }
+        ++header.nodeCount;
+
+        if (!flushChunk(device, buffer, written))
+            return false;
+    }
+
+    header.stringTableOffset = written + buffer.size();
+    header.stringCount = strings.size();
+    foreach (const QString &string, strings) {
+        appendString(buffer, string);
+        if (!flushChunk(device, buffer, written))
+            return false;
+    }
+
+    if (!flushChunk(device, buffer, written, true))
+        return false;
+
+    qint64 end = device->pos();
+    if (!device->seek(start)
+            || device->write(reinterpret_cast<const char*>(&header), sizeof(header)) != sizeof(header)) {
+        return false;
+    }
+    return device->seek(end);
+}
+
+bool TreeModel::save(const QString &fileName) const
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    return save(&file) && file.commit();
+}
+
+bool TreeModel::load(QIODevice *device)
+{
+    if (!device->isReadable())
+        return false;
+
+    QByteArray data = device->readAll();
+    TreeItem staging;
+    if (!readTree(data.constData(), data.size(), &staging))
+        return false;
+
+    replaceTree(&staging);
+    return true;
+}
+
+bool TreeModel::load(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    uchar *data = file.map(0, file.size());
+    if (!data)
+        return load(&file);
+
+    TreeItem staging;
+    bool ok = readTree(reinterpret_cast<const char*>(data), file.size(), &staging);
+    file.unmap(data);
+
+    if (ok)
+        replaceTree(&staging);
+    return ok;
+}
+
+void TreeModel::up(const QModelIndex &index)
+{
+    TREEMODEL_PROBE(Up);
+
+    if (!index.isValid() || index.row() == 0)
+        return;
+
+    moveRows(index.parent(), index.row(), 1, index.parent(), index.row() - 1);
+}
+
+void TreeModel::down(const QModelIndex &index)
+{
+    TREEMODEL_PROBE(Down);
+
+    if (!index.isValid() || index.row() + 1 == rowCount(index.parent()))
+        return;
+
+    moveRows(index.parent(), index.row(), 1, index.parent(), index.row() + 2);
+}
+
+void TreeModel::sort(int column, Qt::SortOrder order)
+{
+    if (column < 0 || column >= columnCount())
+        return;
+
+    _sortColumn = column;
+    _sortOrder = order;
+    clearUndo();
+
+    emit layoutAboutToBeChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+    QModelIndexList oldIndexes = persistentIndexList();
+
+    sortItems(QList<AbstractTreeItem*>() << root());
+
+    QModelIndexList newIndexes;
+    newIndexes.reserve(oldIndexes.size());
+    foreach (const QModelIndex &index, oldIndexes) {
+        AbstractTreeItem *node = static_cast<AbstractTreeItem*>(index.internalPointer());
+        newIndexes.append(createIndex(node->row(), index.column(), node));
+    }
+    changePersistentIndexList(oldIndexes, newIndexes);
+    emit layoutChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+}
+
+void TreeModel::setKeepSorted(bool enabled)
+{
+    _keepSorted = enabled;
+}
+
+bool TreeModel::keepSorted() const
+{
+    return _keepSorted;
+}
+
+QModelIndexList TreeModel::match(const QModelIndex &start, int role, const QVariant &value, int hits,
+                                 Qt::MatchFlags flags) const
+{
+    TreeSearchIndex *index = searchIndex(start.column());
+    QString text = value.toString();
+    // Children still waiting in a snapshot are not indexed yet, the linear
+    // search makes them and finds them
+    bool unindexed = (flags & Qt::MatchRecursive) && _unindexedSubtrees > 0;
+    if (!index || !start.isValid() || (role != Qt::DisplayRole && role != Qt::EditRole)
+            || !TreeSearchIndex::supports(flags) || text.isEmpty() || unindexed) {
+        return AbstractTreeModel::match(start, role, value, hits, flags);
+    }
+
+    QModelIndexList result;
+    if (hits == 0)
+        return result;
+
+    // Keep hits below the parent of start, directly below it unless the
+    // search is recursive
+    const AbstractTreeItem *scope = item(start.parent());
+    bool recursive = flags & Qt::MatchRecursive;
+    bool wrap = flags & Qt::MatchWrap;
+
+    // Same order as a linear search: from the start row on, then the rows
+    // before it when wrapping. The position starts with 1 for wrapped hits
+    // so one comparison covers both. Unless every hit is wanted, found is a
+    // max-heap of the best ones so far.
+    QVector<TreePosition> found;
+    QVector<int> rows;
+    foreach (const TreeItem *hit, index->find(text, flags)) {
+        rows.clear();
+        const AbstractTreeItem *node = hit;
+        while (node->parent() && node->parent() != scope) {
+            rows.append(node->row());
+            node = node->parent();
+        }
+
+        if (!node->parent() || (!recursive && !rows.isEmpty()))
+            continue;
+
+        bool wrapped = node->row() < start.row();
+        if (wrapped && !wrap)
+            continue;
+
+        rows.append(node->row());
+        rows.append(wrapped ? 1 : 0);
+        std::reverse(rows.begin(), rows.end());
+
+        if (hits < 0) {
+            found.append(qMakePair(rows, hit));
+        } else if (found.size() < hits) {
+            found.append(qMakePair(rows, hit));
+            std::push_heap(found.begin(), found.end(), lessPosition);
+        } else if (lessPosition(qMakePair(rows, hit), found.first())) {
+            std::pop_heap(found.begin(), found.end(), lessPosition);
+            found.last() = qMakePair(rows, hit);
+            std::push_heap(found.begin(), found.end(), lessPosition);
+        }
+    }
+    std::sort(found.begin(), found.end(), lessPosition);
+
+    foreach (const TreePosition &position, found) {
+        const TreeItem *hit = position.second;
+        result.append(createIndex(hit->row(), start.column(), const_cast<TreeItem*>(hit)));
+    }
+    return result;
+}
+
+int TreeModel::columnCount(const QModelIndex &parent) const
+{
+    Q_UNUSED(parent)
+    return _columns->columnCount();
+}
+
+QVariant TreeModel::data(const QModelIndex &index, int role) const
+{
+    TREEMODEL_PROBE(Data);
+
+    if (!index.isValid())
+        return QVariant();
+
+    if (role == Qt::DisplayRole || role == Qt::EditRole) {
+        TreeItem *node = static_cast<TreeItem*>(index.internalPointer());
+        return node->data(index.column());
+    }
+
+    if (role >= AggregateRole)
+        return aggregateData(index, role);
+
+    return QVariant();
+}
+
+bool TreeModel::setData(const QModelIndex &index, const QVariant &value, int role)
+{
+    TREEMODEL_PROBE(SetData);
+
+    if (!index.isValid())
+        return false;
+
+    if (role != Qt::EditRole && role != Qt::CheckStateRole && role < Qt::UserRole)
+        return false;
+
+    if (role == Qt::EditRole) {
+        if (_columns->isTyped(index.column()) && !_columns->accepts(index.column(), value.toString()))
+            return false;
+
+        TreeItem *node = static_cast<TreeItem*>(index.internalPointer());
+        beginUndoStep();
+        setItemValue(node, index.column(), value.toString());
+
+        if (isKeptSorted() && index.column() == _sortColumn) {
+            int row = sortedRow(node->parent(), node);
+            if (row != index.row()) {
+                QModelIndex parent = index.parent();
+                moveRows(parent, index.row(), 1, parent, row > index.row() ? row + 1 : row);
+            }
+        }
+        endUndoStep();
+        return true;
+    }
+
+    return false;
+}
+
+bool TreeModel::insertRows(int row, int count, const QModelIndex &parent)
+{
+    TreeItem *parentItem = static_cast<TreeItem*>(item(parent));
+    if (count <= 0 || row < 0 || row > parentItem->childCount())
+        return false;
+
+    QList<AbstractTreeItem*> items;
+    items.reserve(count);
+    for (int i = 0; i < count; ++i)
+        items.append(createItem());
+
+    beginUndoStep();
+    insertItems(parentItem, row, items);
+    endUndoStep();
+    return true;
+}
+
+bool TreeModel::removeRows(int row, int count, const QModelIndex &parent)
+{
+    TREEMODEL_PROBE(RemoveRows);
+
+    AbstractTreeItem *parentItem = item(parent);
+    if (count <= 0 || row < 0 || row + count > parentItem->childCount())
+        return false;
+
+    int cells = 0;
+    QList<AbstractTreeItem*> items = takeItems(parentItem, row, count, _strings ? &cells : 0);
+    if (isRecording()) {
+        // Parked in the log, undo puts the same items back
+        TreeUndoOperation operation(TreeUndoOperation::Remove, parentItem, row, count);
+        operation.parked = items;
+        _undo->record(operation);
+    } else {
+        qDeleteAll(items);
+    }
+
+    releaseStrings(cells);
+    return true;
+}
+
+bool TreeModel::moveRows(const QModelIndex &sourceParent, int sourceRow, int count,
+                         const QModelIndex &destinationParent, int destinationChild)
+{
+    TREEMODEL_PROBE(MoveRows);
+
+    AbstractTreeItem *from = item(sourceParent);
+    AbstractTreeItem *to = item(destinationParent);
+    if (!AbstractTreeModel::moveRows(sourceParent, sourceRow, count, destinationParent, destinationChild))
+        return false;
+
+    if (isRecording()) {
+        TreeUndoOperation operation(TreeUndoOperation::Move, from, sourceRow, count);
+        operation.target = to;
+        operation.targetRow = from == to && destinationChild > sourceRow ? destinationChild - count : destinationChild;
+        _undo->record(operation);
+    }
+    return true;
+}
+
+TreeItem *TreeModel::createItem(const QStringList &values) const
+{
+    return allocateItem(_strings ? _strings->intern(values) : values);
+}
+
+TreeItem *TreeModel::itemFromSnapshot(const TreeSnapshot &snapshot) const
+{
+    // TreeItem::fromSnapshot() with the model's pools
+    TreeItem *item = createItem(snapshot.values());
+    item->setLazySnapshot(snapshot);
+    return item;
+}
+
+void TreeModel::childrenCreated(TreeItem *parent, const QList<AbstractTreeItem*> &items)
+{
+    // The walks that keep these up to date left the children out while
+    // they were pending
+    attachItems(items);
+    if (isKeptSorted())
+        sortItems(QList<AbstractTreeItem*>() << parent);
+    if (!_searchIndexes.isEmpty())
+        --_unindexedSubtrees;
+    indexItems(items);
+    if (aggregator())
+        aggregator()->loaded(items);
+}
+
+TreeItem *TreeModel::allocateItem(const QStringList &values) const
+{
+    if (_poolEnabled)
+        return new (_pool) TreeItem(values);
+    else
+        return new TreeItem(values);
+}
+
+void TreeModel::releaseStrings(int count)
+{
+    if (!_strings)
+        return;
+
+    // Purging walks the whole pool, so only do it once enough cells
+    // went away for the walk to pay for itself
+    _releasedStrings += count;
+    if (_releasedStrings > _strings->size()) {
+        _strings->purge();
+        _releasedStrings = 0;
+    }
+}
+
+void TreeModel::attachItems(const QList<AbstractTreeItem*> &items)
+{
+    if (!_columns->hasTypedColumns())
+        return;
+
+    // Below an attached item everything is attached already, pending
+    // children are attached when they are made
+    foreach (AbstractTreeItem *item, items) {
+        for (TreePreOrderIterator<TreeItem> it(static_cast<TreeItem*>(item)); it.item(); it.next()) {
+            if (it.item()->store() == _columns) {
+                it.skipChildren();
+                continue;
+            }
+            it.item()->attach(_columns);
+            if (it.item()->hasPendingChildren())
+                it.skipChildren();
+        }
+    }
+}
+
+void TreeModel::detachItems(const QList<AbstractTreeItem*> &items)
+{
+    if (!_columns->hasTypedColumns())
+        return;
+
+    foreach (AbstractTreeItem *item, items) {
+        for (TreePreOrderIterator<TreeItem> it(static_cast<TreeItem*>(item)); it.item(); it.next()) {
+            it.item()->detach();
+            if (it.item()->hasPendingChildren())
+                it.skipChildren();
+        }
+    }
+}
+
+void TreeModel::appendItems(const QList<AbstractTreeItem*> &items, const QModelIndex &index)
+{
+    AbstractTreeItem *parentItem = item(index);
+    attachItems(items);
+
+    if (!isKeptSorted()) {
+        beginUndoStep();
+        insertItems(parentItem, parentItem->childCount(), items);
+        endUndoStep();
+        return;
+    }
+
+    // New items that fall between the same two rows go in together
+    QList<AbstractTreeItem*> sorted = items;
+    std::stable_sort(sorted.begin(), sorted.end(), [this](const AbstractTreeItem *left, const AbstractTreeItem *right) {
+        return sortsBefore(left, right);
+    });
+
+    beginUndoStep();
+    int first = 0;
+    while (first < sorted.size()) {
+        int row = sortedRow(parentItem, sorted.at(first));
+        int last = first + 1;
+        while (last < sorted.size()
+               && (row == parentItem->childCount() || sortsBefore(sorted.at(last), parentItem->child(row)))) {
+            ++last;
+        }
+
+        insertItems(parentItem, row, sorted.mid(first, last - first));
+        first = last;
+    }
+    endUndoStep();
+}
+
+void TreeModel::insertItems(AbstractTreeItem *parent, int row, const QList<AbstractTreeItem*> &items)
+{
+    attachItems(items);
+    TREEMODEL_PROBE_CALL(Notify, beginInsertRows(indexFromItem(parent), row, row + items.size() - 1));
+    parent->insertChildren(row, items);
+    TREEMODEL_PROBE_CALL(Notify, endInsertRows());
+    indexItems(items);
+    if (aggregator())
+        aggregatesChanged(aggregator()->inserted(parent, items));
+
+    if (isRecording())
+        _undo->record(TreeUndoOperation(TreeUndoOperation::Insert, parent, row, items.size()));
+}
+
+QList<AbstractTreeItem*> TreeModel::takeItems(AbstractTreeItem *parent, int row, int count, int *cells)
+{
+    // Pending edits may point into the rows going away
+    emitEdits();
+    QList<AbstractTreeItem*> items = parent->children().mid(row, count);
+    if (!_searchIndexes.isEmpty() || cells) {
+        int taken = unindexItems(items);
+        if (cells)
+            *cells = taken;
+    }
+
+    TREEMODEL_PROBE_CALL(Notify, beginRemoveRows(indexFromItem(parent), row, row + count - 1));
+    items = parent->takeChildren(row, count);
+    TREEMODEL_PROBE_CALL(Notify, endRemoveRows());
+    if (aggregator())
+        aggregatesChanged(aggregator()->removed(parent, row, items));
+    // Taken items may outlive the store, in the undo log or with the caller
+    detachItems(items);
+    return items;
+}
+
+void TreeModel::setItemValue(TreeItem *item, int column, const QString &value)
+{
+    freezeMimeData();
+    if (isRecording()) {
+        TreeUndoOperation operation(TreeUndoOperation::Edit, item, column);
+        operation.before = item->value(column);
+        operation.after = value;
+        _undo->record(operation);
+    }
+
+    QVector<double> before;
+    if (aggregator())
+        before = aggregator()->contribution(item);
+
+    TreeSearchIndex *search = searchIndex(column);
+    if (search)
+        search->remove(item);
+    item->setValue(column, _strings ? _strings->intern(value) : value);
+    if (search)
+        search->insert(item);
+    releaseStrings(1);
+
+    recordEdit(item, column, QVector<int>() << Qt::DisplayRole << Qt::EditRole);
+    if (aggregator())
+        aggregatesChanged(aggregator()->changed(item, before));
+    if (_transactionDepth == 0 && (!_commitTimer || !_commitTimer->isActive()))
+        commitEdits();
+}
+
+void TreeModel::aggregatesChanged(const QList<AbstractTreeItem*> &items)
+{
+    // Goes out with the edits, so ancestors are announced once per commit
+    if (items.isEmpty())
+        return;
+
+    QVector<int> roles;
+    for (int slot = 0; slot < aggregator()->count(); ++slot)
+        roles.append(AggregateRole + slot);
+
+    int last = columnCount() - 1;
+    foreach (AbstractTreeItem *changed, items) {
+        if (changed == root())
+            continue;
+        recordEdit(static_cast<TreeItem*>(changed), 0, roles);
+        recordEdit(static_cast<TreeItem*>(changed), last, roles);
+    }
+
+    if (_transactionDepth == 0 && (!_commitTimer || !_commitTimer->isActive()))
+        commitEdits();
+}
+
+bool TreeModel::isRecording() const
+{
+    return _undo && !_replaying;
+}
+
+void TreeModel::beginUndoStep()
+{
+    if (isRecording())
+        _undo->beginStep();
+}
+
+void TreeModel::endUndoStep()
+{
+    if (isRecording())
+        _undo->endStep();
+}
+
+void TreeModel::replay(TreeUndoOperation &operation, bool forward)
+{
+    switch (operation.type) {
+    case TreeUndoOperation::Insert:
+    case TreeUndoOperation::Remove:
+        if (forward == (operation.type == TreeUndoOperation::Insert)) {
+            insertItems(operation.item, operation.row, operation.parked);
+            operation.parked.clear();
+        } else {
+            operation.parked = takeItems(operation.item, operation.row, operation.count);
+        }
+        break;
+
+    case TreeUndoOperation::Move: {
+        // Destination rows count from before the block is taken out
+        bool sameParent = operation.item == operation.target;
+        if (forward) {
+            int row = sameParent && operation.targetRow > operation.row
+                    ? operation.targetRow + operation.count : operation.targetRow;
+            AbstractTreeModel::moveRows(indexFromItem(operation.item), operation.row, operation.count,
+                                        indexFromItem(operation.target), row);
+        } else {
+            int row = sameParent && operation.row > operation.targetRow
+                    ? operation.row + operation.count : operation.row;
+            AbstractTreeModel::moveRows(indexFromItem(operation.target), operation.targetRow, operation.count,
+                                        indexFromItem(operation.item), row);
+        }
+        break;
+    }
+
+    case TreeUndoOperation::Edit:
+        setItemValue(static_cast<TreeItem*>(operation.item), operation.row,
+                     forward ? operation.after : operation.before);
+        break;
+    }
+}
+
+void TreeModel::recordEdit(TreeItem *item, int column, const QVector<int> &roles)
+{
+    QHash<TreeItem*, QPair<int, int> >::iterator it = _pendingEdits.find(item);
+    if (it == _pendingEdits.end()) {
+        _pendingEdits.insert(item, qMakePair(column, column));
+    } else {
+        it.value().first = qMin(it.value().first, column);
+        it.value().second = qMax(it.value().second, column);
+    }
+
+    foreach (int role, roles) {
+        if (!_pendingRoles.contains(role))
+            _pendingRoles.append(role);
+    }
+}
+
+void TreeModel::emitEdits()
+{
+    if (_pendingEdits.isEmpty())
+        return;
+
+    // Rows are looked up now, so edits survive inserts and moves
+    QVector<EditedRow> rows;
+    rows.reserve(_pendingEdits.size());
+    QHash<TreeItem*, QPair<int, int> >::const_iterator it = _pendingEdits.constBegin();
+    for (; it != _pendingEdits.constEnd(); ++it) {
+        EditedRow row = { it.key()->parent(), it.key()->row(), it.value().first, it.value().second, it.key() };
+        rows.append(row);
+    }
+    QVector<int> roles = _pendingRoles;
+    _pendingEdits.clear();
+    _pendingRoles.clear();
+
+    // One dataChanged per run of neighbouring rows under the same parent
+    std::sort(rows.begin(), rows.end(), lessEditedRow);
+    int first = 0;
+    while (first < rows.size()) {
+        int last = first;
+        int firstColumn = rows.at(first).firstColumn;
+        int lastColumn = rows.at(first).lastColumn;
+        while (last + 1 < rows.size() && rows.at(last + 1).parent == rows.at(first).parent
+               && rows.at(last + 1).row == rows.at(last).row + 1) {
+            ++last;
+            firstColumn = qMin(firstColumn, rows.at(last).firstColumn);
+            lastColumn = qMax(lastColumn, rows.at(last).lastColumn);
+        }
+
+        TREEMODEL_PROBE_CALL(Notify, emit dataChanged(createIndex(rows.at(first).row, firstColumn, rows.at(first).item),
+                                                      createIndex(rows.at(last).row, lastColumn, rows.at(last).item),
+                                                      roles));
+        first = last + 1;
+    }
+}
+
+bool TreeModel::isKeptSorted() const
+{
+    return _keepSorted && _sortColumn >= 0;
+}
+
+bool TreeModel::sortsBefore(const AbstractTreeItem *left, const AbstractTreeItem *right) const
+{
+    const TreeItem *leftItem = static_cast<const TreeItem*>(left);
+    const TreeItem *rightItem = static_cast<const TreeItem*>(right);
+    if (_columns->isTyped(_sortColumn)) {
+        int result = _columns->compare(leftItem->slot(), rightItem->slot(), _sortColumn);
+        return _sortOrder == Qt::AscendingOrder ? result < 0 : result > 0;
+    }
+
+    QString leftValue = leftItem->value(_sortColumn);
+    QString rightValue = rightItem->value(_sortColumn);
+    return _sortOrder == Qt::AscendingOrder ? leftValue < rightValue : rightValue < leftValue;
+}
+
+int TreeModel::sortedRow(const AbstractTreeItem *parent, const AbstractTreeItem *item) const
+{
+    // Upper bound among the other children, so equal keys keep the order
+    // they came in
+    int skip = item->parent() == parent ? item->row() : -1;
+    int first = 0;
+    int count = parent->childCount() - (skip < 0 ? 0 : 1);
+    while (count > 0) {
+        int step = count / 2;
+        int mid = first + step;
+        if (!sortsBefore(item, parent->child(skip >= 0 && mid >= skip ? mid + 1 : mid))) {
+            first = mid + 1;
+            count -= step + 1;
+        } else {
+            count = step;
+        }
+    }
+    return first;
+}
+
+void TreeModel::sortItems(const QList<AbstractTreeItem*> &items)
+{
+    // Sorts the children of items and of everything below them. While the
+    // model is kept sorted, children still to be made are sorted when they
+    // are.
+    QList<AbstractTreeItem*> parents;
+    qint64 total = 0;
+    QList<AbstractTreeItem*> pending = items;
+    while (!pending.isEmpty()) {
+        AbstractTreeItem *node = pending.takeLast();
+        if (isKeptSorted() && node->hasPendingChildren())
+            continue;
+        int count = node->childCount();
+        if (count > 1) {
+            parents.append(node);
+            total += count;
+        }
+        for (int row = 0; row < count; ++row)
+            pending.append(node->child(row));
+    }
+
+    if (parents.isEmpty())
+        return;
+
+    // Sibling groups are split into batches of about the same number of
+    // children, one batch per thread
+    int taskCount = total < ParallelSortThreshold ? 1 : qMax(1, QThread::idealThreadCount());
+    QList<SortTask*> tasks;
+    qint64 taskSize = 0;
+    foreach (AbstractTreeItem *parent, parents) {
+        if (tasks.isEmpty() || (taskSize >= total / taskCount && tasks.size() < taskCount)) {
+            tasks.append(new SortTask(_sortColumn, _sortOrder, _columns->isTyped(_sortColumn) ? _columns : 0));
+            taskSize = 0;
+        }
+        tasks.last()->parents.append(parent);
+        taskSize += parent->childCount();
+    }
+
+    // Batches go to the shared global pool, except the first, which this
+    // thread sorts while it waits for the rest
+    QSemaphore done;
+    for (int i = 1; i < tasks.size(); ++i) {
+        tasks.at(i)->done = &done;
+        QThreadPool::globalInstance()->start(tasks.at(i));
+    }
+    tasks.first()->run();
+    done.acquire(tasks.size() - 1);
+
+    // Reordering notifies ancestors, so it is done here and not on the pool.
+    // Children already in order, as made from a sorted copy, keep the
+    // snapshots above them.
+    foreach (SortTask *task, tasks) {
+        for (int i = 0; i < task->parents.size(); ++i) {
+            if (task->orders.at(i) == task->parents.at(i)->children())
+                continue;
+            task->parents.at(i)->reorderChildren(task->orders.at(i));
+            if (aggregator())
+                aggregator()->reordered(task->parents.at(i));
+        }
+    }
+    qDeleteAll(tasks);
+}
+
+bool TreeModel::readTree(const char *data, qint64 size, AbstractTreeItem *parent)
+{
+    if (size < qint64(sizeof(FileHeader)))
+        return false;
+
+    const FileHeader *header = reinterpret_cast<const FileHeader*>(data);
+    if (header->magic != TreeFileMagic || header->version != TreeFileVersion
+            || header->byteOrder != TreeFileByteOrder || header->stringTableOffset > quint64(size)
+            || header->stringTableOffset % sizeof(quint32)) {
+        return false;
+    }
+
+    // Every string takes at least its length word, so a larger count
+    // can't be right and must not size the table
+    if (header->stringCount > (quint64(size) - header->stringTableOffset) / sizeof(quint32))
+        return false;
+
+    // String table first, so cells can share its entries
+    QVector<QString> strings;
+    strings.reserve(header->stringCount);
+    const quint32 *pos = reinterpret_cast<const quint32*>(data + header->stringTableOffset);
+    const quint32 *end = reinterpret_cast<const quint32*>(data + (size & ~qint64(sizeof(quint32) - 1)));
+    for (quint32 i = 0; i < header->stringCount; ++i) {
+        if (pos == end)
+            return false;
+
+        quint32 length = *pos++;
+        quint32 words = (length + 1) / 2;
+        if (quint64(end - pos) < words)
+            return false;
+
+        QString string(reinterpret_cast<const QChar*>(pos), length);
+        strings.append(_strings ? _strings->intern(string) : string);
+        pos += words;
+    }
+
+    // Nodes are in pre-order, each parent waits on the stack until its
+    // children have been read
+    pos = reinterpret_cast<const quint32*>(data + sizeof(FileHeader));
+    end = reinterpret_cast<const quint32*>(data + header->stringTableOffset);
+    if (end - pos < 2 || pos[1] != 0)
+        return false;
+
+    QVector<QPair<AbstractTreeItem*, quint32> > stack;
+    stack.append(qMakePair(parent, pos[0]));
+    pos += 2;
+
+    quint64 nodeCount = 0;
+    QStringList values;
+    while (!stack.isEmpty()) {
+        QPair<AbstractTreeItem*, quint32> &top = stack.last();
+        if (top.second == 0) {
+            stack.removeLast();
+            continue;
+        }
+        --top.second;
+
+        if (end - pos < 2)
+            return false;
+
+        quint32 childCount = pos[0];
+        quint32 valueCount = pos[1];
+        pos += 2;
+        if (quint64(end - pos) < valueCount)
+            return false;
+
+        values.clear();
+        for (quint32 i = 0; i < valueCount; ++i) {
+            if (pos[i] >= quint32(strings.size()))
+                return false;
+            values.append(strings.at(pos[i]));
+        }
+        pos += valueCount;
+
+        // Values come from the string table and are interned already
+        TreeItem *item = allocateItem(values);
+        top.first->appendChild(item);
+        if (childCount > 0)
+            stack.append(qMakePair(static_cast<AbstractTreeItem*>(item), childCount));
+        ++nodeCount;
+    }
+
+    return nodeCount == header->nodeCount && pos == end;
+}
+
+void TreeModel::moveDropped(const QList<QPersistentModelIndex> &indexes, int row, const QModelIndex &parent)
+{
+    AbstractTreeItem *parentItem = item(parent);
+    int destination = row < 0 ? parentItem->childCount() : row;
+
+    beginUndoStep();
+    foreach (const QPersistentModelIndex &index, indexes) {
+        // Rows removed since the drag started are gone from the list
+        if (!index.isValid())
+            continue;
+
+        QModelIndex sourceParent = index.parent();
+        int sourceRow = index.row();
+        if (isKeptSorted()) {
+            AbstractTreeItem *node = item(index);
+            destination = sortedRow(parentItem, node);
+            if (node->parent() == parentItem && destination >= sourceRow)
+                ++destination;
+        }
+
+        // Rows that can't move, like a row dropped into itself, stay
+        // where they are
+        moveRows(sourceParent, sourceRow, 1, parent, destination);
+        if (index.parent() == parent)
+            destination = index.row() + 1;
+    }
+    endUndoStep();
+}
+
+void TreeModel::insertDropped(const QList<AbstractTreeItem*> &items, int row, const QModelIndex &parent)
+{
+    if (isKeptSorted()) {
+        attachItems(items);
+        sortItems(items);
+        appendItems(items, parent);
+        return;
+    }
+
+    AbstractTreeItem *parentItem = item(parent);
+    beginUndoStep();
+    insertItems(parentItem, row < 0 ? parentItem->childCount() : row, items);
+    endUndoStep();
+}
+
+void TreeModel::replaceTree(AbstractTreeItem *parent)
+{
+    beginResetModel();
+    clearUndo();
+    qDeleteAll(root()->takeChildren(0, root()->childCount()));
+    root()->insertChildren(0, parent->takeChildren(0, parent->childCount()));
+    attachItems(root()->children());
+    if (_strings)
+        _strings->purge();
+    _releasedStrings = 0;
+    foreach (TreeSearchIndex *index, _searchIndexes)
+        index->clear();
+    _unindexedSubtrees = 0;
+    indexItems(root()->children());
+    _pendingEdits.clear();
+    rebuildAggregates();
+    endResetModel();
+}
+
+TreeSearchIndex *TreeModel::searchIndex(int column) const
+{
+    foreach (TreeSearchIndex *index, _searchIndexes) {
+        if (index->column() == column)
+            return index;
+    }
+    return 0;
+}
+
+void TreeModel::indexItems(const QList<AbstractTreeItem*> &items)
+{
+    if (_searchIndexes.isEmpty())
+        return;
+
+    foreach (AbstractTreeItem *item, items) {
+        for (TreePreOrderIterator<TreeItem> it(static_cast<TreeItem*>(item)); it.item(); it.next()) {
+            foreach (TreeSearchIndex *index, _searchIndexes)
+                index->insert(it.item());
+            if (it.item()->hasPendingChildren()) {
+                ++_unindexedSubtrees;
+                it.skipChildren();
+            }
+        }
+    }
+}
+
+int TreeModel::unindexItems(const QList<AbstractTreeItem*> &items)
+{
+    // Counts the cells on the way, children still to be made hold none
+    int cells = 0;
+    foreach (AbstractTreeItem *item, items) {
+        for (TreePreOrderIterator<TreeItem> it(static_cast<TreeItem*>(item)); it.item(); it.next()) {
+            foreach (TreeSearchIndex *index, _searchIndexes)
+                index->remove(it.item());
+            cells += it.item()->_values.size();
+            if (it.item()->hasPendingChildren()) {
+                if (!_searchIndexes.isEmpty())
+                    --_unindexedSubtrees;
+                it.skipChildren();
+            }
+        }
+    }
+    return cells;
+}
+
+QVariant TreeModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation == Qt::Orientation::Horizontal && role == Qt::DisplayRole) {
+        if (section < 0 || section >= _columns->columnCount())
+            return QVariant();
+        return _columns->columns().at(section).name;
+    }
+    else {
+        return AbstractTreeModel::headerData(section, orientation, role);
+    }
+}
+
+Qt::ItemFlags TreeModel::flags(const QModelIndex &index) const
+{
+    // Drops on the empty area go to the top level
+    if (!index.isValid())
+        return AbstractTreeModel::flags(index) | Qt::ItemIsDropEnabled;
+
+    Qt::ItemFlags f = Qt::ItemIsSelectable | Qt::ItemIsEnabled | Qt::ItemIsEditable
+        | Qt::ItemIsDragEnabled | Qt::ItemIsDropEnabled;
     return f;
 }
+
+void TreeModel::commitEdits()
+{
+    if (_transactionDepth > 0 || _pendingEdits.isEmpty())
+        return;
+
+    emitEdits();
+
+    // Later commits wait until the timer runs out
+    if (_commitTimer)
+        _commitTimer->start();
+}
+
+void TreeModel::evictRows(AbstractTreeItem *parent, int row, int count)
+{
+    // Deleted rather than parked for undo, and history that still points
+    // at them or at rows of the parent has to go too
+    if (_undo) {
+        QSet<const AbstractTreeItem*> evicted;
+        evicted.insert(parent);
+        for (int i = row; i < row + count; ++i) {
+            for (TreePreOrderIterator<AbstractTreeItem> it(parent->child(i)); it.item(); it.next()) {
+                evicted.insert(it.item());
+                if (it.item()->hasPendingChildren())
+                    it.skipChildren();
+            }
+        }
+        _undo->forget(evicted);
+    }
+    int cells = 0;
+    qDeleteAll(takeItems(parent, row, count, _strings ? &cells : 0));
+    releaseStrings(cells);
+}
+
+void TreeModel::fetchMore(const QModelIndex &parent)
+{
+    AbstractTreeItem *parentItem = item(parent);
+    int first = parentItem->childCount();
+    AbstractTreeModel::fetchMore(parent);
+    if (parentItem->childCount() > first) {
+        QList<AbstractTreeItem*> items = parentItem->children().mid(first);
+        attachItems(items);
+        indexItems(items);
+    }
+}
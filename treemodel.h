@@ -27,8 +27,23 @@
 
 #include "abstracttreeitem.h"
 #include "abstracttreemodel.h"
+#include "treecolumnstore.h"
+#include "treesnapshot.h"
 
+#include <QHash>
+#include <QPair>
+#include <QPointer>
 #include <QStringList>
+#include <QVector>
+
+class QIODevice;
+class QMimeData;
+class QTimer;
+class StringPool;
+class TreeItemPool;
+class TreeSearchIndex;
+class TreeUndoLog;
+struct TreeUndoOperation;
 
 class TreeItem : public AbstractTreeItem
 {
@@ -36,17 +51,68 @@ public:
     explicit TreeItem(const QStringList &values = QStringList(), AbstractTreeItem *parent = 0);
     ~TreeItem();
 
+    static void *operator new(size_t size);
+    static void *operator new(size_t size, TreeItemPool *pool);
+    static void operator delete(void *ptr);
+    static void operator delete(void *ptr, TreeItemPool *pool);
+
     void setValue(int column, const QString &name);
     QString value(int column) const;
 
     void setValues(const QStringList &values);
     QStringList values() const;
+    // Native value of a typed column, the string of any other
+    QVariant data(int column) const;
+
+    // Keeps the typed columns of the store in it instead of the values
+    void attach(TreeColumnStore *store);
+    void detach();
+    TreeColumnStore *store() const;
+    quint32 slot() const;
+
+    TreeSnapshot snapshot() const;
+    // Same contents as snapshot(), but the items below keep no snapshots
+    // of their own afterwards, for one-off copies
+    TreeSnapshot uncachedSnapshot() const;
+    bool hasSnapshot() const;
+    static TreeItem *fromSnapshot(const TreeSnapshot &snapshot);
 
     TreeItem *clone() const;
+    bool hasPendingChildren() const override;
+    double aggregateValue(int column) const override;
+    QVector<double> pendingAggregates(const TreeAggregator &aggregator) const override;
     QString toString() const;
 
+protected:
+    void loadChildren() const override;
+    void childrenChanged() override;
+
 private:
+    friend class TreeModel;
+    struct SnapshotVisitor;
+
+    // Called on the item at the top of the tree: it makes the children
+    // loadChildren() creates and hears about them once they are adopted
+    virtual TreeItem *createChild(const TreeSnapshot &snapshot) const;
+    virtual void childrenCreated(TreeItem *parent, const QList<AbstractTreeItem*> &items) const;
+
+    void invalidateSnapshot();
+    void moveToStore();
+    // Children are made from the snapshot on first use
+    void setLazySnapshot(const TreeSnapshot &snapshot);
+    void internValues(StringPool *strings);
+    double number(const QString &text, int column) const;
+
     QStringList _values;
+    TreeColumnStore *_store;
+    quint32 _slot;
+    // Set while the children still live only in _snapshot
+    mutable bool _childrenPending;
+
+    // Snapshot of this subtree while it is unchanged. Items created from a
+    // snapshot create their children from it on first use and let go of
+    // it then.
+    mutable TreeSnapshot _snapshot;
 };
 
 class TreeModel : public AbstractTreeModel
@@ -58,13 +124,154 @@ public:
     ~TreeModel();
 
     void add(const QStringList &values, const QModelIndex &index);
+    void addMany(const QVector<QStringList> &values, const QModelIndex &index);
+    void addItems(const QList<AbstractTreeItem*> &items, const QModelIndex &index);
     void remove(const QModelIndex &index);
+    void clear();
+
+    void setNodePoolEnabled(bool enabled);
+    bool isNodePoolEnabled() const;
+    const TreeItemPool *nodePool() const;
+
+    void setStringPoolEnabled(bool enabled);
+    bool isStringPoolEnabled() const;
+    const StringPool *stringPool() const;
+
+    // Int64, Double and Bool columns keep native values in the column
+    // store, everything else stays a string. Values that don't parse as
+    // the column type are left empty.
+    void setColumns(const QVector<TreeColumn> &columns);
+    QVector<TreeColumn> columns() const;
+    const TreeColumnStore *columnStore() const;
+
+    void setIndexedColumns(const QList<int> &columns);
+    QList<int> indexedColumns() const;
+
+    // Edits inside a transaction are announced together when the
+    // outermost one is committed, merged into row ranges per parent
+    void beginTransaction();
+    void commitTransaction();
+    // Announces edits at most this many times a second, 0 for no limit
+    void setMaxCommitRate(int commitsPerSecond);
+    int maxCommitRate() const;
+
+    // Keeps this many steps of add, remove, move and edit history, 0 turns
+    // it off. sort(), clear() and load() drop the history, evict() the
+    // steps that touched the evicted rows.
+    void setUndoLimit(int steps);
+    int undoLimit() const;
+    bool canUndo() const;
+    bool canRedo() const;
+    bool undo();
+    bool redo();
+    void clearUndo();
+
+    // Current contents for readers on other threads, which need no locks
+    // while this thread goes on changing the model. Call it from the
+    // model's thread. snapshotVersion() is the version of the last one and
+    // only grows when the contents changed in between.
+    TreeSnapshot snapshot() const;
+    quint64 snapshotVersion() const;
+
+    // Drags and the clipboard carry whole subtrees. A move inside the
+    // model splices the rows, anything else reads them in the tree file
+    // format and inserts them with one notification. dropMimeData()
+    // returns false after such a move, as the rows are in place already
+    // and a view must not remove the source rows on its own.
+    QStringList mimeTypes() const override;
+    QMimeData *mimeData(const QModelIndexList &indexes) const override;
+    bool dropMimeData(const QMimeData *data, Qt::DropAction action, int row, int column,
+                      const QModelIndex &parent) override;
+    Qt::DropActions supportedDropActions() const override;
+
+    bool save(QIODevice *device) const;
+    bool save(const QString &fileName) const;
+    bool load(QIODevice *device);
+    bool load(const QString &fileName);
+
     void up(const QModelIndex &index);
     void down(const QModelIndex &index);
 
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+    // New rows and edited sort keys keep the order of the last sort()
+    void setKeepSorted(bool enabled);
+    bool keepSorted() const;
+
+    QModelIndexList match(const QModelIndex &start, int role, const QVariant &value, int hits = 1,
+                          Qt::MatchFlags flags = Qt::MatchFlags(Qt::MatchStartsWith | Qt::MatchWrap)) const override;
+
     int columnCount(const QModelIndex &parent = QModelIndex()) const override;
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
     bool setData(const QModelIndex &index, const QVariant &value, int role) override;
+    bool insertRows(int row, int count, const QModelIndex &parent = QModelIndex()) override;
+    bool removeRows(int row, int count, const QModelIndex &parent = QModelIndex()) override;
+    bool moveRows(const QModelIndex &sourceParent, int sourceRow, int count,
+                  const QModelIndex &destinationParent, int destinationChild) override;
     QVariant headerData(int section, Qt::Orientation orientation, int role) const override;
     Qt::ItemFlags flags(const QModelIndex &index) const;
+    void fetchMore(const QModelIndex &parent) override;
+
+protected:
+    void aggregatesChanged(const QList<AbstractTreeItem*> &items) override;
+    void evictRows(AbstractTreeItem *parent, int row, int count) override;
+
+private slots:
+    void commitEdits();
+    // Takes the snapshots of rows handed out by mimeData() before they change
+    void freezeMimeData();
+
+private:
+    class RootItem;
+
+    TreeItem *createItem(const QStringList &values = QStringList()) const;
+    TreeItem *itemFromSnapshot(const TreeSnapshot &snapshot) const;
+    void childrenCreated(TreeItem *parent, const QList<AbstractTreeItem*> &items);
+    TreeItem *allocateItem(const QStringList &values) const;
+    void releaseStrings(int count);
+    void attachItems(const QList<AbstractTreeItem*> &items);
+    void detachItems(const QList<AbstractTreeItem*> &items);
+    void appendItems(const QList<AbstractTreeItem*> &items, const QModelIndex &index);
+    void insertItems(AbstractTreeItem *parent, int row, const QList<AbstractTreeItem*> &items);
+    // cells, when given, is set to the number of cells taken with the items
+    QList<AbstractTreeItem*> takeItems(AbstractTreeItem *parent, int row, int count, int *cells = 0);
+    void setItemValue(TreeItem *item, int column, const QString &value);
+    bool isRecording() const;
+    void beginUndoStep();
+    void endUndoStep();
+    void replay(TreeUndoOperation &operation, bool forward);
+    bool isKeptSorted() const;
+    bool sortsBefore(const AbstractTreeItem *left, const AbstractTreeItem *right) const;
+    int sortedRow(const AbstractTreeItem *parent, const AbstractTreeItem *item) const;
+    void sortItems(const QList<AbstractTreeItem*> &items);
+    void recordEdit(TreeItem *item, int column, const QVector<int> &roles);
+    void emitEdits();
+    bool readTree(const char *data, qint64 size, AbstractTreeItem *parent);
+    void moveDropped(const QList<QPersistentModelIndex> &indexes, int row, const QModelIndex &parent);
+    void insertDropped(const QList<AbstractTreeItem*> &items, int row, const QModelIndex &parent);
+    void replaceTree(AbstractTreeItem *parent);
+    TreeSearchIndex *searchIndex(int column) const;
+    void indexItems(const QList<AbstractTreeItem*> &items);
+    int unindexItems(const QList<AbstractTreeItem*> &items);
+
+    TreeItemPool *_pool;
+    bool _poolEnabled;
+    StringPool *_strings;
+    int _releasedStrings;
+    QList<TreeSearchIndex*> _searchIndexes;
+    // Indexed items whose children are still pending and left out
+    int _unindexedSubtrees;
+    int _sortColumn;
+    Qt::SortOrder _sortOrder;
+    bool _keepSorted;
+    int _transactionDepth;
+    QTimer *_commitTimer;
+    // Edited items with the first and last edited column
+    QHash<TreeItem*, QPair<int, int> > _pendingEdits;
+    QVector<int> _pendingRoles;
+    TreeUndoLog *_undo;
+    bool _replaying;
+    mutable quint64 _snapshotVersion;
+    TreeColumnStore *_columns;
+    // Handed out by mimeData() and not frozen yet
+    mutable QList<QPointer<QMimeData> > _mimeData;
 };
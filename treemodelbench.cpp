@@ -0,0 +1,633 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#include "treeexporter.h"
+#include "treemodel.h"
+#include "treeitempool.h"
+#include "treeiterator.h"
+#include "typedtreemodel.h"
+
+#include <QBuffer>
+#include <QDebug>
+#include <QPersistentModelIndex>
+#include <QTest>
+
+namespace {
+
+enum TreeShape
+{
+    Wide,
+    Deep,
+    Balanced
+};
+
+// Deep trees are made of chains this long, item destructors recurse
+const int ChainLength = 1000;
+const int Fanout = 10;
+const int SampleCount = 1000;
+const int BatchSize = 100000;
+
+QStringList nodeValues(int node)
+{
+    return QStringList() << QString("Node %1").arg(node) << QString::number(node % 100) << "Data";
+}
+
+// The columns of nodeValues() as a TypedTreeModel payload
+struct NodePayload
+{
+    QString name;
+    int number;
+    QString data;
+};
+
+NodePayload nodePayload(int node)
+{
+    NodePayload payload = { QString("Node %1").arg(node), node % 100, "Data" };
+    return payload;
+}
+
+int countItems(const AbstractTreeItem *item)
+{
+    int count = 1;
+    for (int row = 0; row < item->childCount(); ++row)
+        count += countItems(item->child(row));
+    return count;
+}
+
+}
+
+template <>
+struct TreePayloadTraits<NodePayload>
+{
+    typedef TreeColumnList<
+        TreeMemberColumn<NodePayload, QString, &NodePayload::name>,
+        TreeMemberColumn<NodePayload, int, &NodePayload::number>,
+        TreeMemberColumn<NodePayload, QString, &NodePayload::data> > Columns;
+};
+
+typedef TypedTreeModel<NodePayload> NodeModel;
+
+// Run with -o results.xml,xml or -csv for machine readable results.
+// TREEMODEL_BENCH_MAX_NODES limits the tree sizes.
+class TreeModelBench : public QObject
+{
+    Q_OBJECT
+
+public:
+    TreeModelBench();
+    ~TreeModelBench();
+
+private slots:
+    void index_data();
+    void index();
+    void parent_data();
+    void parent();
+    void rowCount_data();
+    void rowCount();
+    void add_data();
+    void add();
+    void remove_data();
+    void remove();
+    void upDown_data();
+    void upDown();
+    void clone_data();
+    void clone();
+    void setData_data();
+    void setData();
+    void buildAndClear_data();
+    void buildAndClear();
+    void typedData_data();
+    void typedData();
+    void typedSetPayload_data();
+    void typedSetPayload();
+    void exportTsv_data();
+    void exportTsv();
+    void snapshotThenClear();
+    void preOrderWalk_data();
+    void preOrderWalk();
+    void breadthFirstWalk_data();
+    void breadthFirstWalk();
+    void queuedBreadthFirstWalk_data();
+    void queuedBreadthFirstWalk();
+
+private:
+    void shapes(bool pooled = false);
+    void balancedSizes();
+    TreeModel *tree();
+    NodeModel *typedTree();
+    void buildTree(TreeModel *model, int shape, int nodes);
+    void buildTypedTree(NodeModel *model, int nodes);
+    QModelIndexList sampleLeaves(QAbstractItemModel *model);
+    QModelIndexList sampleParents(QAbstractItemModel *model);
+
+    TreeModel *_model;
+    int _shape;
+    int _nodes;
+    NodeModel *_typedModel;
+    int _typedNodes;
+};
+
+TreeModelBench::TreeModelBench()
+    : _model(0)
+    , _shape(-1)
+    , _nodes(0)
+    , _typedModel(0)
+    , _typedNodes(0)
+{
+}
+
+TreeModelBench::~TreeModelBench()
+{
+    delete _model;
+    delete _typedModel;
+}
+
+void TreeModelBench::index_data()
+{
+    shapes();
+}
+
+void TreeModelBench::index()
+{
+    TreeModel *model = tree();
+    QModelIndexList leaves = sampleLeaves(model);
+    QModelIndexList parents;
+    foreach (const QModelIndex &leaf, leaves)
+        parents.append(leaf.parent());
+
+    QBENCHMARK {
+        for (int i = 0; i < leaves.size(); ++i)
+            model->index(leaves.at(i).row(), 0, parents.at(i));
+    }
+}
+
+void TreeModelBench::parent_data()
+{
+    shapes();
+}
+
+void TreeModelBench::parent()
+{
+    TreeModel *model = tree();
+    QModelIndexList leaves = sampleLeaves(model);
+
+    QBENCHMARK {
+        foreach (const QModelIndex &leaf, leaves)
+            model->parent(leaf);
+    }
+}
+
+void TreeModelBench::rowCount_data()
+{
+    shapes();
+}
+
+void TreeModelBench::rowCount()
+{
+    TreeModel *model = tree();
+    QModelIndexList parents = sampleParents(model);
+
+    QBENCHMARK {
+        foreach (const QModelIndex &parent, parents)
+            model->rowCount(parent);
+    }
+}
+
+void TreeModelBench::add_data()
+{
+    shapes();
+}
+
+void TreeModelBench::add()
+{
+    TreeModel *model = tree();
+    QList<QPersistentModelIndex> parents;
+    foreach (const QModelIndex &parent, sampleParents(model))
+        parents.append(parent);
+    QStringList values = nodeValues(0);
+
+    int next = 0;
+    QBENCHMARK {
+        model->add(values, parents.at(next++ % parents.size()));
+    }
+}
+
+void TreeModelBench::remove_data()
+{
+    shapes();
+}
+
+void TreeModelBench::remove()
+{
+    TreeModel *model = tree();
+    QList<QPersistentModelIndex> leaves;
+    foreach (const QModelIndex &leaf, sampleLeaves(model))
+        leaves.append(leaf);
+
+    // Leaves only go once, so each sample is removed a single time
+    QBENCHMARK_ONCE {
+        foreach (const QPersistentModelIndex &leaf, leaves)
+            model->remove(leaf);
+    }
+
+    delete _model;
+    _model = 0;
+}
+
+void TreeModelBench::upDown_data()
+{
+    shapes();
+}
+
+void TreeModelBench::upDown()
+{
+    TreeModel *model = tree();
+
+    // Nearest node above each sampled leaf that has a next sibling
+    QList<QPersistentModelIndex> items;
+    foreach (QModelIndex index, sampleLeaves(model)) {
+        while (index.isValid() && index.row() + 1 >= model->rowCount(index.parent()))
+            index = index.parent();
+        if (index.isValid())
+            items.append(index);
+    }
+    if (items.isEmpty())
+        QSKIP("No node with a next sibling");
+
+    QBENCHMARK {
+        foreach (const QPersistentModelIndex &item, items) {
+            model->down(item);
+            model->up(item);
+        }
+    }
+}
+
+void TreeModelBench::clone_data()
+{
+    shapes();
+}
+
+void TreeModelBench::clone()
+{
+    TreeModel *model = tree();
+    TreeItem *item = static_cast<TreeItem*>(model->index(0, 0).internalPointer());
+
+    // Visiting the copy makes it create all of its items
+    QBENCHMARK {
+        TreeItem *copy = item->clone();
+        countItems(copy);
+        delete copy;
+    }
+}
+
+void TreeModelBench::setData_data()
+{
+    shapes();
+}
+
+void TreeModelBench::setData()
+{
+    TreeModel *model = tree();
+    QModelIndexList leaves = sampleLeaves(model);
+    QVariant value("Edited");
+
+    QBENCHMARK {
+        foreach (const QModelIndex &leaf, leaves)
+            model->setData(leaf, value, Qt::EditRole);
+    }
+}
+
+void TreeModelBench::buildAndClear_data()
+{
+    shapes(true);
+}
+
+void TreeModelBench::buildAndClear()
+{
+    QFETCH(int, shape);
+    QFETCH(int, nodes);
+    QFETCH(bool, pooled);
+
+    qint64 reserved = 0;
+    int live = 0;
+    QBENCHMARK {
+        TreeModel model;
+        model.setNodePoolEnabled(pooled);
+        buildTree(&model, shape, nodes);
+        if (pooled) {
+            reserved = model.nodePool()->reservedBytes();
+            live = model.nodePool()->liveCount();
+        }
+        model.clear();
+    }
+
+    if (pooled) {
+        qDebug() << "sizeof(TreeItem)" << int(sizeof(TreeItem)) << "slab bytes per item"
+                 << double(reserved) / qMax(live, 1);
+    }
+}
+
+void TreeModelBench::typedData_data()
+{
+    balancedSizes();
+}
+
+void TreeModelBench::typedData()
+{
+    // Same rows and cells as data() reads from a TreeModel, but the ints
+    // stay ints
+    NodeModel *model = typedTree();
+    QModelIndexList leaves = sampleLeaves(model);
+
+    QBENCHMARK {
+        foreach (const QModelIndex &leaf, leaves) {
+            for (int column = 0; column < model->columnCount(); ++column)
+                model->data(leaf.sibling(leaf.row(), column));
+        }
+    }
+}
+
+void TreeModelBench::typedSetPayload_data()
+{
+    balancedSizes();
+}
+
+void TreeModelBench::typedSetPayload()
+{
+    // With a sum over the int column, so every edit updates the ancestors
+    NodeModel *model = typedTree();
+    model->addAggregate(TreeAggregate::Sum, 1);
+    QModelIndexList leaves = sampleLeaves(model);
+
+    int next = 0;
+    QBENCHMARK {
+        foreach (const QModelIndex &leaf, leaves)
+            model->setPayload(leaf, nodePayload(next++));
+    }
+    model->clearAggregates();
+}
+
+void TreeModelBench::exportTsv_data()
+{
+    shapes();
+}
+
+void TreeModelBench::exportTsv()
+{
+    TreeModel *model = tree();
+    TreeExporter exporter(TreeExporter::IndentedTsv);
+
+    QBENCHMARK {
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        exporter.write(&buffer, model);
+    }
+}
+
+void TreeModelBench::snapshotThenClear()
+{
+    // Not a benchmark: children removed after snapshot() used to be made
+    // again from the cached snapshots
+    TreeModel model;
+    buildTree(&model, Balanced, 1000);
+    model.snapshot();
+
+    QModelIndex first = model.index(0, 0);
+    model.removeRows(0, model.rowCount(first), first);
+    QCOMPARE(model.rowCount(first), 0);
+
+    model.clear();
+    QCOMPARE(model.rowCount(), 0);
+}
+
+void TreeModelBench::preOrderWalk_data()
+{
+    shapes();
+}
+
+void TreeModelBench::preOrderWalk()
+{
+    const AbstractTreeItem *root = tree()->itemFromIndex(QModelIndex());
+
+    qint64 count = 0;
+    QBENCHMARK {
+        for (TreePreOrderIterator<const AbstractTreeItem> it(root); it.item(); it.next())
+            ++count;
+    }
+    QVERIFY(count > 0);
+}
+
+void TreeModelBench::breadthFirstWalk_data()
+{
+    shapes();
+}
+
+void TreeModelBench::breadthFirstWalk()
+{
+    // Every level walks the ones above it again, deep trees would take
+    // hours. queuedBreadthFirstWalk covers them.
+    QFETCH(int, shape);
+    if (shape == Deep)
+        QSKIP("O(items * height) on chains of ChainLength items");
+
+    const AbstractTreeItem *root = tree()->itemFromIndex(QModelIndex());
+
+    qint64 count = 0;
+    QBENCHMARK {
+        for (TreeBreadthFirstIterator<const AbstractTreeItem> it(root); it.item(); it.next())
+            ++count;
+    }
+    QVERIFY(count > 0);
+}
+
+void TreeModelBench::queuedBreadthFirstWalk_data()
+{
+    shapes();
+}
+
+void TreeModelBench::queuedBreadthFirstWalk()
+{
+    const AbstractTreeItem *root = tree()->itemFromIndex(QModelIndex());
+
+    QQueue<const AbstractTreeItem*> queue;
+    qint64 count = 0;
+    QBENCHMARK {
+        for (TreeBreadthFirstIterator<const AbstractTreeItem> it(root, &queue); it.item(); it.next())
+            ++count;
+    }
+    QVERIFY(count > 0);
+}
+
+void TreeModelBench::shapes(bool pooled)
+{
+    QTest::addColumn<int>("shape");
+    QTest::addColumn<int>("nodes");
+    if (pooled)
+        QTest::addColumn<bool>("pooled");
+
+    int maxNodes = qEnvironmentVariableIntValue("TREEMODEL_BENCH_MAX_NODES");
+    const char *names[] = { "wide", "deep", "balanced" };
+    for (int shape = Wide; shape <= Balanced; ++shape) {
+        for (int nodes = 10000; nodes <= 10000000; nodes *= 10) {
+            if (maxNodes > 0 && nodes > maxNodes)
+                break;
+
+            QByteArray name = QString("%1/%2").arg(names[shape]).arg(nodes).toLatin1();
+            if (!pooled) {
+                QTest::newRow(name.constData()) << shape << nodes;
+                continue;
+            }
+            QTest::newRow((name + "/heap").constData()) << shape << nodes << false;
+            QTest::newRow((name + "/pool").constData()) << shape << nodes << true;
+        }
+    }
+}
+
+void TreeModelBench::balancedSizes()
+{
+    // The payload doesn't care about the shape, so typed models are only
+    // built balanced
+    QTest::addColumn<int>("nodes");
+
+    int maxNodes = qEnvironmentVariableIntValue("TREEMODEL_BENCH_MAX_NODES");
+    for (int nodes = 10000; nodes <= 10000000; nodes *= 10) {
+        if (maxNodes > 0 && nodes > maxNodes)
+            break;
+
+        QByteArray name = QString("balanced/%1").arg(nodes).toLatin1();
+        QTest::newRow(name.constData()) << nodes;
+    }
+}
+
+TreeModel *TreeModelBench::tree()
+{
+    QFETCH(int, shape);
+    QFETCH(int, nodes);
+
+    // The same tree is reused until a benchmark changes its shape
+    if (_model && _shape == shape && _nodes == nodes)
+        return _model;
+
+    delete _model;
+    _model = new TreeModel;
+    _shape = shape;
+    _nodes = nodes;
+    buildTree(_model, shape, nodes);
+    return _model;
+}
+
+NodeModel *TreeModelBench::typedTree()
+{
+    QFETCH(int, nodes);
+
+    if (_typedModel && _typedNodes == nodes)
+        return _typedModel;
+
+    delete _typedModel;
+    _typedModel = new NodeModel;
+    _typedNodes = nodes;
+    buildTypedTree(_typedModel, nodes);
+    return _typedModel;
+}
+
+void TreeModelBench::buildTree(TreeModel *model, int shape, int nodes)
+{
+    int added = 0;
+
+    if (shape == Wide) {
+        while (added < nodes) {
+            QVector<QStringList> values;
+            for (int i = 0; i < BatchSize && added < nodes; ++i)
+                values.append(nodeValues(added++));
+            model->addMany(values, QModelIndex());
+        }
+    } else if (shape == Deep) {
+        while (added < nodes) {
+            QModelIndex parent;
+            for (int depth = 0; depth < ChainLength && added < nodes; ++depth) {
+                model->add(nodeValues(added++), parent);
+                parent = model->index(model->rowCount(parent) - 1, 0, parent);
+            }
+        }
+    } else {
+        QList<QModelIndex> pending;
+        pending.append(QModelIndex());
+        while (added < nodes) {
+            QModelIndex parent = pending.takeFirst();
+            QVector<QStringList> values;
+            for (int i = 0; i < Fanout && added < nodes; ++i)
+                values.append(nodeValues(added++));
+            model->addMany(values, parent);
+            for (int row = 0; row < values.size(); ++row)
+                pending.append(model->index(row, 0, parent));
+        }
+    }
+}
+
+void TreeModelBench::buildTypedTree(NodeModel *model, int nodes)
+{
+    int added = 0;
+    QList<QModelIndex> pending;
+    pending.append(QModelIndex());
+    while (added < nodes) {
+        QModelIndex parent = pending.takeFirst();
+        QVector<NodePayload> payloads;
+        for (int i = 0; i < Fanout && added < nodes; ++i)
+            payloads.append(nodePayload(added++));
+        model->addMany(payloads, parent);
+        for (int row = 0; row < payloads.size(); ++row)
+            pending.append(model->index(row, 0, parent));
+    }
+}
+
+QModelIndexList TreeModelBench::sampleLeaves(QAbstractItemModel *model)
+{
+    // Same pseudo random paths from the root down to a leaf every run
+    QModelIndexList leaves;
+    quint32 seed = 1;
+    for (int i = 0; i < SampleCount; ++i) {
+        QModelIndex index;
+        int rows = model->rowCount(index);
+        while (rows > 0) {
+            seed = seed * 1103515245 + 12345;
+            index = model->index((seed >> 8) % rows, 0, index);
+            rows = model->rowCount(index);
+        }
+        if (index.isValid())
+            leaves.append(index);
+    }
+    return leaves;
+}
+
+QModelIndexList TreeModelBench::sampleParents(QAbstractItemModel *model)
+{
+    QModelIndexList parents;
+    foreach (const QModelIndex &leaf, sampleLeaves(model))
+        parents.append(leaf.parent());
+    return parents;
+}
+
+QTEST_GUILESS_MAIN(TreeModelBench)
+
+#include "treemodelbench.moc"
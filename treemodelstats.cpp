@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#include "treemodelstats.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QPointer>
+#include <QStringList>
+
+namespace {
+
+class StatsLogger : public QObject
+{
+public:
+    explicit StatsLogger(QObject *parent)
+        : QObject(parent)
+        , _timer(0)
+    {
+    }
+
+    void setInterval(int msecs)
+    {
+        if (_timer)
+            killTimer(_timer);
+        _timer = msecs > 0 ? startTimer(msecs) : 0;
+    }
+
+protected:
+    void timerEvent(QTimerEvent *event) override
+    {
+        Q_UNUSED(event)
+        qDebug().noquote() << TreeModelStats::report();
+    }
+
+private:
+    int _timer;
+};
+
+QPointer<StatsLogger> logger;
+
+}
+
+TreeModelStats::Entry TreeModelStats::_entries[TreeModelStats::OperationCount];
+
+QString TreeModelStats::operationName(Operation operation)
+{
+    static const char *names[] = {
+        "index", "parent", "rowCount", "data", "setData", "add", "remove", "up", "down",
+        "addMany", "removeRows", "moveRows", "notify"
+    };
+    return operation < OperationCount ? names[operation] : "";
+}
+
+quint64 TreeModelStats::count(Operation operation)
+{
+    return _entries[operation].count.load();
+}
+
+quint64 TreeModelStats::sampleCount(Operation operation)
+{
+    return _entries[operation].samples.load();
+}
+
+quint64 TreeModelStats::averageNanoseconds(Operation operation)
+{
+    quint64 samples = _entries[operation].samples.load();
+    return samples ? _entries[operation].total.load() / samples : 0;
+}
+
+quint64 TreeModelStats::maxNanoseconds(Operation operation)
+{
+    return _entries[operation].max.load();
+}
+
+quint64 TreeModelStats::percentileNanoseconds(Operation operation, double percentile)
+{
+    // Upper edge of the bucket the percentile falls into
+    QVector<quint64> buckets = histogram(operation);
+    quint64 samples = 0;
+    foreach (quint64 bucket, buckets)
+        samples += bucket;
+    if (!samples)
+        return 0;
+
+    quint64 wanted = qMax<quint64>(1, quint64(samples * percentile / 100.0 + 0.5));
+    quint64 seen = 0;
+    for (int i = 0; i < buckets.size(); ++i) {
+        seen += buckets.at(i);
+        if (seen >= wanted)
+            return quint64(1) << i;
+    }
+    return maxNanoseconds(operation);
+}
+
+QVector<quint64> TreeModelStats::histogram(Operation operation)
+{
+    QVector<quint64> buckets(BucketCount);
+    for (int i = 0; i < BucketCount; ++i)
+        buckets[i] = _entries[operation].buckets[i].load();
+    return buckets;
+}
+
+QString TreeModelStats::report()
+{
+    QStringList lines;
+    for (int i = 0; i < OperationCount; ++i) {
+        Operation operation = Operation(i);
+        if (!count(operation))
+            continue;
+
+        lines.append(QString("%1: calls %2, avg %3 ns, p50 < %4 ns, p99 < %5 ns, max %6 ns")
+                     .arg(operationName(operation))
+                     .arg(count(operation))
+                     .arg(averageNanoseconds(operation))
+                     .arg(percentileNanoseconds(operation, 50))
+                     .arg(percentileNanoseconds(operation, 99))
+                     .arg(maxNanoseconds(operation)));
+    }
+    return lines.join("\n");
+}
+
+void TreeModelStats::reset()
+{
+    for (int i = 0; i < OperationCount; ++i) {
+        Entry &entry = _entries[i];
+        entry.count.store(0);
+        entry.samples.store(0);
+        entry.total.store(0);
+        entry.max.store(0);
+        for (int bucket = 0; bucket < BucketCount; ++bucket)
+            entry.buckets[bucket].store(0);
+    }
+}
+
+void TreeModelStats::setLogInterval(int msecs)
+{
+    if (!logger)
+        logger = new StatsLogger(QCoreApplication::instance());
+    logger->setInterval(msecs);
+}
+
+void TreeModelStats::end(Operation operation, quint64 start)
+{
+    quint64 elapsed = now() - start;
+    Entry &entry = _entries[operation];
+    entry.samples.fetchAndAddRelaxed(1);
+    entry.total.fetchAndAddRelaxed(elapsed);
+
+    quint64 max = entry.max.load();
+    while (elapsed > max && !entry.max.testAndSetRelaxed(max, elapsed))
+        max = entry.max.load();
+
+    int bucket = 0;
+    for (quint64 value = elapsed; value && bucket < BucketCount - 1; value >>= 1)
+        ++bucket;
+    entry.buckets[bucket].fetchAndAddRelaxed(1);
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <QAtomicInteger>
+#include <QString>
+#include <QVector>
+
+#include <chrono>
+
+// Call counts and latency histograms for the model entry points. Probes
+// are compiled in only when TREEMODEL_STATS is defined. Every call is
+// counted, one call in SampleRate is timed.
+class TreeModelStats
+{
+public:
+    enum Operation
+    {
+        Index,
+        Parent,
+        RowCount,
+        Data,
+        SetData,
+        Add,
+        Remove,
+        Up,
+        Down,
+        AddMany,
+        RemoveRows,
+        MoveRows,
+        // Row and data change signals, within the operations above
+        Notify,
+        OperationCount
+    };
+
+    enum
+    {
+        SampleRate = 16,
+        // Bucket i counts samples shorter than 2^i ns
+        BucketCount = 32
+    };
+
+    static QString operationName(Operation operation);
+
+    static quint64 count(Operation operation);
+    static quint64 sampleCount(Operation operation);
+    static quint64 averageNanoseconds(Operation operation);
+    static quint64 maxNanoseconds(Operation operation);
+    static quint64 percentileNanoseconds(Operation operation, double percentile);
+    static QVector<quint64> histogram(Operation operation);
+
+    static QString report();
+    static void reset();
+
+    // Writes report() to the debug log every msecs, 0 stops it
+    static void setLogInterval(int msecs);
+
+    static quint64 begin(Operation operation)
+    {
+        quint64 calls = _entries[operation].count.fetchAndAddRelaxed(1);
+        return calls % SampleRate ? 0 : now();
+    }
+
+    static void end(Operation operation, quint64 start);
+
+private:
+    struct Entry
+    {
+        QAtomicInteger<quint64> count;
+        QAtomicInteger<quint64> samples;
+        QAtomicInteger<quint64> total;
+        QAtomicInteger<quint64> max;
+        QAtomicInteger<quint64> buckets[BucketCount];
+    };
+
+    static quint64 now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static Entry _entries[OperationCount];
+};
+
+class TreeModelProbe
+{
+public:
+    explicit TreeModelProbe(TreeModelStats::Operation operation)
+        : _operation(operation)
+        , _start(TreeModelStats::begin(operation))
+    {
+    }
+
+    ~TreeModelProbe()
+    {
+        if (_start)
+            TreeModelStats::end(_operation, _start);
+    }
+
+private:
+    TreeModelStats::Operation _operation;
+    quint64 _start;
+};
+
+// TREEMODEL_PROBE_CALL times one statement, for probes nested in another
+#ifdef TREEMODEL_STATS
+#define TREEMODEL_PROBE(operation) TreeModelProbe treeModelProbe(TreeModelStats::operation)
+#define TREEMODEL_PROBE_CALL(operation, statement) \
+    do { TreeModelProbe treeModelProbe(TreeModelStats::operation); statement; } while (0)
+#else
+#define TREEMODEL_PROBE(operation)
+#define TREEMODEL_PROBE_CALL(operation, statement) do { statement; } while (0)
+#endif
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#include "treesearchindex.h"
+#include "treemodel.h"
+
+namespace {
+
+quint64 trigram(const QString &value, int pos)
+{
+    return quint64(value.at(pos).unicode()) << 32
+            | quint64(value.at(pos + 1).unicode()) << 16
+            | value.at(pos + 2).unicode();
+}
+
+bool matches(const QString &value, const QString &text, uint matchType, Qt::CaseSensitivity cs)
+{
+    switch (matchType) {
+    case Qt::MatchExactly:
+    case Qt::MatchFixedString:
+        return value.compare(text, cs) == 0;
+    case Qt::MatchStartsWith:
+        return value.startsWith(text, cs);
+    case Qt::MatchEndsWith:
+        return value.endsWith(text, cs);
+    case Qt::MatchContains:
+        return value.contains(text, cs);
+    default:
+        return false;
+    }
+}
+
+}
+
+TreeSearchIndex::TreeSearchIndex(int column)
+    : _column(column)
+{
+}
+
+TreeSearchIndex::~TreeSearchIndex()
+{
+}
+
+int TreeSearchIndex::column() const
+{
+    return _column;
+}
+
+void TreeSearchIndex::insert(const TreeItem *item)
+{
+    insert(item, item->value(_column));
+}
+
+void TreeSearchIndex::insert(const TreeItem *item, const QString &value)
+{
+    if (value.isEmpty())
+        return;
+
+    QString key = value.toCaseFolded();
+    QSet<const TreeItem*> &items = _values[key];
+    if (items.isEmpty()) {
+        for (int pos = 0; pos + 3 <= key.size(); ++pos)
+            _trigrams[trigram(key, pos)].insert(key);
+    }
+    items.insert(item);
+}
+
+void TreeSearchIndex::remove(const TreeItem *item)
+{
+    remove(item, item->value(_column));
+}
+
+void TreeSearchIndex::remove(const TreeItem *item, const QString &value)
+{
+    if (value.isEmpty())
+        return;
+
+    QString key = value.toCaseFolded();
+    QMap<QString, QSet<const TreeItem*> >::iterator it = _values.find(key);
+    if (it == _values.end())
+        return;
+
+    it.value().remove(item);
+    if (!it.value().isEmpty())
+        return;
+
+    // Last item with this value, so the value leaves the trigram lists too
+    _values.erase(it);
+    for (int pos = 0; pos + 3 <= key.size(); ++pos) {
+        QHash<quint64, QSet<QString> >::iterator gram = _trigrams.find(trigram(key, pos));
+        if (gram == _trigrams.end())
+            continue;
+
+        gram.value().remove(key);
+        if (gram.value().isEmpty())
+            _trigrams.erase(gram);
+    }
+}
+
+void TreeSearchIndex::clear()
+{
+    _values.clear();
+    _trigrams.clear();
+}
+
+bool TreeSearchIndex::supports(Qt::MatchFlags flags)
+{
+    switch (uint(flags & 0x0F)) {
+    case Qt::MatchExactly:
+    case Qt::MatchFixedString:
+    case Qt::MatchStartsWith:
+    case Qt::MatchEndsWith:
+    case Qt::MatchContains:
+        return true;
+    default:
+        return false;
+    }
+}
+
+QList<const TreeItem*> TreeSearchIndex::find(const QString &text, Qt::MatchFlags flags) const
+{
+    uint matchType = flags & 0x0F;
+    // Plain MatchExactly compares variants, which is case sensitive
+    Qt::CaseSensitivity cs = (flags & Qt::MatchCaseSensitive) || matchType == Qt::MatchExactly
+            ? Qt::CaseSensitive : Qt::CaseInsensitive;
+
+    QList<const TreeItem*> result;
+    if (text.isEmpty())
+        return result;
+
+    foreach (const QString &key, candidates(text.toCaseFolded(), matchType)) {
+        foreach (const TreeItem *item, _values.value(key)) {
+            if (cs == Qt::CaseInsensitive || matches(item->value(_column), text, matchType, cs))
+                result.append(item);
+        }
+    }
+    return result;
+}
+
+QList<QString> TreeSearchIndex::candidates(const QString &key, uint matchType) const
+{
+    QList<QString> keys;
+
+    if (matchType == Qt::MatchExactly || matchType == Qt::MatchFixedString) {
+        if (_values.contains(key))
+            keys.append(key);
+        return keys;
+    }
+
+    if (matchType == Qt::MatchStartsWith) {
+        QMap<QString, QSet<const TreeItem*> >::const_iterator it = _values.lowerBound(key);
+        for (; it != _values.constEnd() && it.key().startsWith(key); ++it)
+            keys.append(it.key());
+        return keys;
+    }
+
+    if (matchType == Qt::MatchContains && key.size() >= 3) {
+        // Every trigram of the key must occur in the value, so the
+        // shortest posting list holds all candidates
+        const QSet<QString> *smallest = 0;
+        for (int pos = 0; pos + 3 <= key.size(); ++pos) {
+            QHash<quint64, QSet<QString> >::const_iterator gram = _trigrams.constFind(trigram(key, pos));
+            if (gram == _trigrams.constEnd())
+                return keys;
+
+            if (!smallest || gram.value().size() < smallest->size())
+                smallest = &gram.value();
+        }
+
+        foreach (const QString &value, *smallest) {
+            if (value.contains(key))
+                keys.append(value);
+        }
+        return keys;
+    }
+
+    // Short substrings and suffixes are checked against every distinct value
+    QMap<QString, QSet<const TreeItem*> >::const_iterator it = _values.constBegin();
+    for (; it != _values.constEnd(); ++it) {
+        if (matches(it.key(), key, matchType, Qt::CaseSensitive))
+            keys.append(it.key());
+    }
+    return keys;
+}
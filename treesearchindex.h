@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QSet>
+#include <QString>
+
+class TreeItem;
+
+// Lookup table from the values of one column to the items holding them.
+// Values are kept case folded and sorted for exact and prefix lookups, and
+// trigrams of every distinct value narrow down substring searches.
+class TreeSearchIndex
+{
+public:
+    explicit TreeSearchIndex(int column);
+    ~TreeSearchIndex();
+
+    int column() const;
+
+    void insert(const TreeItem *item);
+    void insert(const TreeItem *item, const QString &value);
+    void remove(const TreeItem *item);
+    void remove(const TreeItem *item, const QString &value);
+    void clear();
+
+    static bool supports(Qt::MatchFlags flags);
+    QList<const TreeItem*> find(const QString &text, Qt::MatchFlags flags) const;
+
+private:
+    QList<QString> candidates(const QString &key, uint matchType) const;
+
+    int _column;
+    QMap<QString, QSet<const TreeItem*> > _values;
+    QHash<quint64, QSet<QString> > _trigrams;
+};
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#include "treesnapshot.h"
+
+TreeSnapshot::TreeSnapshot()
+{
+}
+
+TreeSnapshot::TreeSnapshot(const QStringList &values, const QVector<TreeSnapshot> &children)
+    : d(new TreeSnapshotData)
+{
+    d->values = values;
+    d->children = children;
+}
+
+TreeSnapshot::~TreeSnapshot()
+{
+}
+
+bool TreeSnapshot::isNull() const
+{
+    return !d;
+}
+
+QStringList TreeSnapshot::values() const
+{
+    return d ? d->values : QStringList();
+}
+
+QString TreeSnapshot::value(int column) const
+{
+    return d && column < d->values.size() ? d->values.at(column) : "";
+}
+
+int TreeSnapshot::childCount() const
+{
+    return d ? d->children.size() : 0;
+}
+
+TreeSnapshot TreeSnapshot::child(int row) const
+{
+    Q_ASSERT(d && row < d->children.size());
+    return d->children.at(row);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <QExplicitlySharedDataPointer>
+#include <QMetaType>
+#include <QSharedData>
+#include <QStringList>
+#include <QVector>
+
+class TreeSnapshotData;
+
+// Immutable, implicitly shared copy of a TreeItem subtree. Copies are
+// cheap and can be read from any thread. Unchanged subtrees are shared
+// between versions, and a version is freed with its last copy.
+class TreeSnapshot
+{
+public:
+    TreeSnapshot();
+    TreeSnapshot(const QStringList &values, const QVector<TreeSnapshot> &children);
+    ~TreeSnapshot();
+
+    bool isNull() const;
+
+    QStringList values() const;
+    QString value(int column) const;
+    int childCount() const;
+    TreeSnapshot child(int row) const;
+
+private:
+    QExplicitlySharedDataPointer<TreeSnapshotData> d;
+};
+
+Q_DECLARE_METATYPE(TreeSnapshot)
+
+class TreeSnapshotData : public QSharedData
+{
+public:
+    QStringList values;
+    QVector<TreeSnapshot> children;
+};
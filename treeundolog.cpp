@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#include "treeundolog.h"
+#include "abstracttreeitem.h"
+
+TreeUndoOperation::TreeUndoOperation(Type type, AbstractTreeItem *item, int row, int count)
+    : type(type)
+    , item(item)
+    , row(row)
+    , count(count)
+    , target(0)
+    , targetRow(0)
+{
+}
+
+TreeUndoLog::TreeUndoLog(int limit)
+    : _limit(qMax(limit, 1))
+    , _depth(0)
+{
+}
+
+TreeUndoLog::~TreeUndoLog()
+{
+    clear();
+}
+
+void TreeUndoLog::setLimit(int steps)
+{
+    _limit = qMax(steps, 1);
+    while (_undo.size() > _limit) {
+        release(_undo.first());
+        _undo.removeFirst();
+    }
+}
+
+int TreeUndoLog::limit() const
+{
+    return _limit;
+}
+
+void TreeUndoLog::beginStep()
+{
+    ++_depth;
+}
+
+void TreeUndoLog::endStep()
+{
+    if (_depth > 0)
+        --_depth;
+    if (_depth > 0 || _current.isEmpty())
+        return;
+
+    // A new change makes the undone ones unreachable
+    for (int i = 0; i < _redo.size(); ++i)
+        release(_redo[i]);
+    _redo.clear();
+
+    _undo.append(_current);
+    _current.clear();
+    setLimit(_limit);
+}
+
+void TreeUndoLog::record(const TreeUndoOperation &operation)
+{
+    _current.append(operation);
+    if (_depth == 0)
+        endStep();
+}
+
+bool TreeUndoLog::canUndo() const
+{
+    return !_undo.isEmpty();
+}
+
+bool TreeUndoLog::canRedo() const
+{
+    return !_redo.isEmpty();
+}
+
+TreeUndoStep &TreeUndoLog::nextUndo()
+{
+    return _undo.last();
+}
+
+TreeUndoStep &TreeUndoLog::nextRedo()
+{
+    return _redo.last();
+}
+
+void TreeUndoLog::undone()
+{
+    _redo.append(_undo.takeLast());
+}
+
+void TreeUndoLog::redone()
+{
+    _undo.append(_redo.takeLast());
+}
+
+void TreeUndoLog::clear()
+{
+    release(_current);
+    _current.clear();
+    for (int i = 0; i < _undo.size(); ++i)
+        release(_undo[i]);
+    _undo.clear();
+    for (int i = 0; i < _redo.size(); ++i)
+        release(_redo[i]);
+    _redo.clear();
+}
+
+void TreeUndoLog::forget(const QSet<const AbstractTreeItem*> &items)
+{
+    if (refersTo(_current, items)) {
+        release(_current);
+        _current.clear();
+    }
+    forget(_undo, items);
+    forget(_redo, items);
+}
+
+void TreeUndoLog::forget(QList<TreeUndoStep> &steps, const QSet<const AbstractTreeItem*> &items)
+{
+    // Both stacks are replayed from the end, a step further in front
+    // relies on the ones behind it having been replayed first
+    int last = steps.size() - 1;
+    while (last >= 0 && !refersTo(steps.at(last), items))
+        --last;
+
+    for (int i = 0; i <= last; ++i)
+        release(steps[i]);
+    steps.erase(steps.begin(), steps.begin() + last + 1);
+}
+
+bool TreeUndoLog::refersTo(const TreeUndoStep &step, const QSet<const AbstractTreeItem*> &items)
+{
+    foreach (const TreeUndoOperation &operation, step) {
+        if (items.contains(operation.item) || (operation.target && items.contains(operation.target)))
+            return true;
+    }
+    return false;
+}
+
+void TreeUndoLog::release(TreeUndoStep &step)
+{
+    for (int i = 0; i < step.size(); ++i) {
+        qDeleteAll(step[i].parked);
+        step[i].parked.clear();
+    }
+}
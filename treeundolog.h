@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <QList>
+#include <QSet>
+#include <QString>
+
+class AbstractTreeItem;
+
+// One model change with what it takes to apply it in either direction
+struct TreeUndoOperation
+{
+    enum Type
+    {
+        Insert,
+        Remove,
+        Move,
+        Edit
+    };
+
+    TreeUndoOperation(Type type, AbstractTreeItem *item, int row, int count = 0);
+
+    Type type;
+    // Insert and Remove: parent and first row. Move: source parent and
+    // first row. Edit: the item and the column.
+    AbstractTreeItem *item;
+    int row;
+    int count;
+    // Move: destination parent and the row the block ended up at
+    AbstractTreeItem *target;
+    int targetRow;
+    // Edit: the values before and after
+    QString before;
+    QString after;
+    // Rows that are out of the tree at the moment, owned by the log
+    QList<AbstractTreeItem*> parked;
+};
+
+typedef QList<TreeUndoOperation> TreeUndoStep;
+
+// Undo and redo stacks of model changes. Removed rows are parked in the
+// log instead of being copied, so a step costs memory in proportion to
+// the rows it touched.
+class TreeUndoLog
+{
+public:
+    explicit TreeUndoLog(int limit);
+    ~TreeUndoLog();
+
+    void setLimit(int steps);
+    int limit() const;
+
+    // Operations recorded between the outermost begin and end form a step
+    void beginStep();
+    void endStep();
+    void record(const TreeUndoOperation &operation);
+
+    bool canUndo() const;
+    bool canRedo() const;
+    TreeUndoStep &nextUndo();
+    TreeUndoStep &nextRedo();
+    void undone();
+    void redone();
+
+    void clear();
+    // Drops the steps that refer to any of the items, together with the
+    // steps that could only be reached through them
+    void forget(const QSet<const AbstractTreeItem*> &items);
+
+private:
+    static void release(TreeUndoStep &step);
+    static bool refersTo(const TreeUndoStep &step, const QSet<const AbstractTreeItem*> &items);
+    static void forget(QList<TreeUndoStep> &steps, const QSet<const AbstractTreeItem*> &items);
+
+    int _limit;
+    int _depth;
+    TreeUndoStep _current;
+    QList<TreeUndoStep> _undo;
+    QList<TreeUndoStep> _redo;
+};
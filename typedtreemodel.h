@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2015  Ivan Romanov <drizt@land.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include "abstracttreeitem.h"
+#include "abstracttreemodel.h"
+#include "treeaggregate.h"
+#include "treeiterator.h"
+
+#include <QStringList>
+#include <QVariant>
+#include <QVector>
+#include <QtNumeric>
+
+#include <type_traits>
+
+// Column of a TypedTreeModel that reads and writes a member of the payload
+template <typename Payload, typename Value, Value Payload::*Member>
+struct TreeMemberColumn
+{
+    typedef Value Type;
+
+    static const Value &get(const Payload &payload) { return payload.*Member; }
+    static void set(Payload &payload, const Value &value) { payload.*Member = value; }
+};
+
+// Columns of a payload in order. A column is picked by a chain of
+// comparisons the compiler sees through, without virtual calls, and values
+// keep their own type instead of going through QString.
+template <typename... Columns>
+struct TreeColumnList;
+
+template <>
+struct TreeColumnList<>
+{
+    enum { Count = 0 };
+
+    template <typename Payload>
+    static QVariant value(const Payload &, int) { return QVariant(); }
+    template <typename Payload>
+    static bool setValue(Payload &, int, const QVariant &) { return false; }
+    template <typename Payload>
+    static double number(const Payload &, int) { return qQNaN(); }
+};
+
+template <typename Column, typename... Rest>
+struct TreeColumnList<Column, Rest...>
+{
+    enum { Count = 1 + TreeColumnList<Rest...>::Count };
+
+    template <typename Payload>
+    static QVariant value(const Payload &payload, int column)
+    {
+        if (column != 0)
+            return TreeColumnList<Rest...>::value(payload, column - 1);
+        return QVariant::fromValue(Column::get(payload));
+    }
+
+    template <typename Payload>
+    static bool setValue(Payload &payload, int column, const QVariant &value)
+    {
+        typedef typename Column::Type Type;
+        if (column != 0)
+            return TreeColumnList<Rest...>::setValue(payload, column - 1, value);
+        if (!value.canConvert<Type>())
+            return false;
+
+        Column::set(payload, value.value<Type>());
+        return true;
+    }
+
+    // Arithmetic columns take part in sums, minimums and maximums
+    template <typename Payload>
+    static double number(const Payload &payload, int column)
+    {
+        if (column != 0)
+            return TreeColumnList<Rest...>::number(payload, column - 1);
+        return toNumber(Column::get(payload));
+    }
+
+private:
+    template <typename Value>
+    static typename std::enable_if<std::is_arithmetic<Value>::value, double>::type toNumber(const Value &value)
+    {
+        return double(value);
+    }
+
+    template <typename Value>
+    static typename std::enable_if<!std::is_arithmetic<Value>::value, double>::type toNumber(const Value &)
+    {
+        return qQNaN();
+    }
+};
+
+// Specialized for every payload type used with TypedTreeModel:
+//
+//   template <>
+//   struct TreePayloadTraits<Employee>
+//   {
+//       typedef TreeColumnList<
+//           TreeMemberColumn<Employee, QString, &Employee::name>,
+//           TreeMemberColumn<Employee, int, &Employee::age> > Columns;
+//   };
+template <typename Payload>
+struct TreePayloadTraits;
+
+template <typename Payload>
+class TypedTreeItem : public AbstractTreeItem
+{
+public:
+    typedef typename TreePayloadTraits<Payload>::Columns Columns;
+    // The model announces changes up to column Count - 1
+    static_assert(Columns::Count > 0, "TreePayloadTraits must declare at least one column");
+
+    explicit TypedTreeItem(const Payload &payload = Payload(), AbstractTreeItem *parent = 0)
+        : AbstractTreeItem(parent)
+        , _payload(payload)
+    {
+    }
+
+    const Payload &payload() const { return _payload; }
+    Payload &payload() { return _payload; }
+    void setPayload(const Payload &payload) { _payload = payload; }
+
+    TypedTreeItem *clone() const override
+    {
+        // parents holds the copies along the path to the current item
+        TypedTreeItem *copy = new TypedTreeItem(_payload);
+        QVector<TypedTreeItem*> parents;
+        parents.append(copy);
+
+        TreePreOrderIterator<const TypedTreeItem> it(this);
+        for (it.next(); it.item(); it.next()) {
+            parents.resize(it.depth());
+            TypedTreeItem *item = new TypedTreeItem(it.item()->_payload);
+            parents.last()->appendChild(item);
+            parents.append(item);
+        }
+        return copy;
+    }
+
+    QString toString() const override
+    {
+        QStringList values;
+        for (int column = 0; column < Columns::Count; ++column)
+            values << Columns::value(_payload, column).toString();
+        return values.join(" ");
+    }
+
+    double aggregateValue(int column) const override
+    {
+        return Columns::number(_payload, column);
+    }
+
+private:
+    Payload _payload;
+};
+
+// Tree of payload structs with the columns TreePayloadTraits declares.
+// Indexes, parents, removing, moving and aggregates come from
+// AbstractTreeModel.
+template <typename Payload>
+class TypedTreeModel : public AbstractTreeModel
+{
+public:
+    typedef TypedTreeItem<Payload> Item;
+    typedef typename Item::Columns Columns;
+
+    explicit TypedTreeModel(QObject *parent = 0)
+        : AbstractTreeModel(new Item, parent)
+    {
+    }
+
+    QModelIndex add(const Payload &payload, const QModelIndex &parent = QModelIndex())
+    {
+        addMany(QVector<Payload>(1, payload), parent);
+        return index(rowCount(parent) - 1, 0, parent);
+    }
+
+    void addMany(const QVector<Payload> &payloads, const QModelIndex &parent = QModelIndex())
+    {
+        if (payloads.isEmpty())
+            return;
+
+        QList<AbstractTreeItem*> items;
+        items.reserve(payloads.size());
+        foreach (const Payload &payload, payloads)
+            items.append(new Item(payload));
+
+        AbstractTreeItem *parentItem = item(parent);
+        int row = parentItem->childCount();
+        beginInsertRows(parent, row, row + items.size() - 1);
+        parentItem->insertChildren(row, items);
+        endInsertRows();
+
+        if (aggregator())
+            aggregatesChanged(aggregator()->inserted(parentItem, items));
+    }
+
+    const Payload &payload(const QModelIndex &index) const
+    {
+        return static_cast<const Item*>(item(index))->payload();
+    }
+
+    void setPayload(const QModelIndex &index, const Payload &payload)
+    {
+        if (!index.isValid())
+            return;
+
+        Item *node = static_cast<Item*>(index.internalPointer());
+        QVector<double> before;
+        if (aggregator())
+            before = aggregator()->contribution(node);
+
+        node->setPayload(payload);
+        emit dataChanged(this->index(index.row(), 0, index.parent()),
+                         this->index(index.row(), Columns::Count - 1, index.parent()));
+        if (aggregator())
+            aggregatesChanged(aggregator()->changed(node, before));
+    }
+
+    void setHeaderLabels(const QStringList &labels)
+    {
+        _headers = labels;
+        emit headerDataChanged(Qt::Horizontal, 0, Columns::Count - 1);
+    }
+
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override
+    {
+        Q_UNUSED(parent)
+        return Columns::Count;
+    }
+
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override
+    {
+        if (!index.isValid())
+            return QVariant();
+
+        if (role == Qt::DisplayRole || role == Qt::EditRole)
+            return Columns::value(static_cast<const Item*>(index.internalPointer())->payload(), index.column());
+
+        if (role >= AggregateRole)
+            return aggregateData(index, role);
+
+        return QVariant();
+    }
+
+    bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole) override
+    {
+        if (!index.isValid() || role != Qt::EditRole)
+            return false;
+
+        Item *node = static_cast<Item*>(index.internalPointer());
+        QVector<double> before;
+        if (aggregator())
+            before = aggregator()->contribution(node);
+
+        if (!Columns::setValue(node->payload(), index.column(), value))
+            return false;
+
+        emit dataChanged(index, index, QVector<int>() << Qt::DisplayRole << Qt::EditRole);
+        if (aggregator())
+            aggregatesChanged(aggregator()->changed(node, before));
+        return true;
+    }
+
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override
+    {
+        if (orientation == Qt::Horizontal && role == Qt::DisplayRole && section < _headers.size())
+            return _headers.at(section);
+
+        return AbstractTreeModel::headerData(section, orientation, role);
+    }
+
+    Qt::ItemFlags flags(const QModelIndex &index) const override
+    {
+        if (!index.isValid())
+            return AbstractTreeModel::flags(index);
+
+        return Qt::ItemIsSelectable | Qt::ItemIsEnabled | Qt::ItemIsEditable;
+    }
+
+private:
+    QStringList _headers;
+};